@@ -0,0 +1,556 @@
+/* End-to-end regression test of the QRSS processing chains.
+ *
+ * A synthetic signal (fixed beacons and noise seed) is pushed through the real (AudioSource) or
+ * complex (IQAudioSource) processing chain, AGC -> QRSS, as fast as possible. The signal is
+ * generated in chunks ahead of the chain, hence only the processing is timed.
+ *
+ * The test checks that the level of a beacon measured from the generated signal matches, that the
+ * beacons are visible in every spectrum computed entirely while they are keyed, and that a
+ * SpectrumHistory fed with the spectra reproduces them exactly at full and at reduced time
+ * resolution using less memory than the uncompressed spectra. These checks run after the timed
+ * section.
+ *
+ * Optionally, the PSD frames are compared against a golden file (--golden) and the wall time, CPU
+ * time and peak RSS per minute of processed signal against a baseline file (--baseline). A given
+ * but missing file is an error, unless --record is given, which (re-) records the given files. */
+
+#include <QObject>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <string>
+#include <type_traits>
+#include <vector>
+#include <stdint.h>
+#include <time.h>
+#include <sys/resource.h>
+#include "qrss.hh"
+#include "synthetic.hh"
+#include "history.hh"
+
+
+using namespace sdr;
+
+/** Magic of the golden files. */
+#define GOLDEN_MAGIC "QRSSGLD2"
+/** Magic of the baseline files. */
+#define BASELINE_MAGIC "QRSSBAS1"
+/** Number of blocks generated before they are processed, one minute of signal. */
+#define REGRESS_CHUNK_BLOCKS 3750
+
+
+/** The golden spectra of a chain. */
+class Golden
+{
+public:
+  /** Number of bins per frame. */
+  uint32_t bins;
+  /** The PSD frames in dB, frame by frame. */
+  std::vector<float> frames;
+
+public:
+  /** Constructor. */
+  Golden() : bins(0), frames() { }
+
+  /** Returns the number of frames. */
+  size_t numFrames() const { return bins ? frames.size()/bins : 0; }
+
+  /** Reads the golden file, returns @c false if it can not be read. */
+  bool read(const std::string &filename) {
+    FILE *file = fopen(filename.c_str(), "rb");
+    if (0 == file) { return false; }
+    char magic[8]; uint32_t nframes = 0; bool ok = true;
+    ok = ok && (1 == fread(magic, 8, 1, file)) && (0 == memcmp(magic, GOLDEN_MAGIC, 8));
+    ok = ok && (1 == fread(&bins, sizeof(uint32_t), 1, file));
+    ok = ok && (1 == fread(&nframes, sizeof(uint32_t), 1, file));
+    if (ok) {
+      frames.resize(size_t(nframes)*bins);
+      ok = (frames.size() == fread(frames.data(), sizeof(float), frames.size(), file));
+    }
+    fclose(file);
+    return ok;
+  }
+
+  /** Writes the golden file. */
+  bool write(const std::string &filename) const {
+    FILE *file = fopen(filename.c_str(), "wb");
+    if (0 == file) { return false; }
+    uint32_t nframes = numFrames(); bool ok = true;
+    ok = ok && (1 == fwrite(GOLDEN_MAGIC, 8, 1, file));
+    ok = ok && (1 == fwrite(&bins, sizeof(uint32_t), 1, file));
+    ok = ok && (1 == fwrite(&nframes, sizeof(uint32_t), 1, file));
+    ok = ok && (frames.size() == fwrite(frames.data(), sizeof(float), frames.size(), file));
+    fclose(file);
+    return ok;
+  }
+};
+
+
+/** The baseline resource usage of a chain, depends on the machine. */
+class Baseline
+{
+public:
+  /** Wall time per minute of signal in s. */
+  double wallTime;
+  /** CPU time per minute of signal in s. */
+  double cpuTime;
+  /** Peak RSS in kB. */
+  double peakRSS;
+
+public:
+  /** Constructor. */
+  Baseline() : wallTime(0), cpuTime(0), peakRSS(0) { }
+
+  /** Reads the baseline file, returns @c false if it can not be read. */
+  bool read(const std::string &filename) {
+    FILE *file = fopen(filename.c_str(), "rb");
+    if (0 == file) { return false; }
+    char magic[8]; bool ok = true;
+    ok = ok && (1 == fread(magic, 8, 1, file)) && (0 == memcmp(magic, BASELINE_MAGIC, 8));
+    ok = ok && (1 == fread(&wallTime, sizeof(double), 1, file));
+    ok = ok && (1 == fread(&cpuTime, sizeof(double), 1, file));
+    ok = ok && (1 == fread(&peakRSS, sizeof(double), 1, file));
+    fclose(file);
+    return ok;
+  }
+
+  /** Writes the baseline file. */
+  bool write(const std::string &filename) const {
+    FILE *file = fopen(filename.c_str(), "wb");
+    if (0 == file) { return false; }
+    bool ok = true;
+    ok = ok && (1 == fwrite(BASELINE_MAGIC, 8, 1, file));
+    ok = ok && (1 == fwrite(&wallTime, sizeof(double), 1, file));
+    ok = ok && (1 == fwrite(&cpuTime, sizeof(double), 1, file));
+    ok = ok && (1 == fwrite(&peakRSS, sizeof(double), 1, file));
+    fclose(file);
+    return ok;
+  }
+};
+
+
+/** Returns the CPU time of the process in s. */
+static double
+cpuTime() {
+  struct timespec ts;
+  clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+  return ts.tv_sec + 1e-9*ts.tv_nsec;
+}
+
+/** Returns the peak RSS of the process in kB. */
+static double
+peakRSS() {
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_maxrss;
+}
+
+
+/** Counts the beacons keyed during the complete FFT window of @c window s ending at @c t and
+ * those not visible at least @c snr dB above the median of the spectrum @c psd. */
+static void
+checkDetection(const QRSSGenerator &gen, const Buffer<double> &psd, double Fbfo, double df,
+               double window, double t, double snr, size_t &keyed, size_t &missed)
+{
+  if (t < window) { return; }
+  std::vector<double> sorted(psd.size());
+  for (size_t i=0; i<psd.size(); i++) { sorted[i] = psd[i]; }
+  std::nth_element(sorted.begin(), sorted.begin()+sorted.size()/2, sorted.end());
+  double median = sorted[sorted.size()/2];
+
+  int N = psd.size();
+  for (size_t b=0; b<gen.numBeacons(); b++) {
+    double F0, F1;
+    if ((! gen.keyed(b, t-window, &F0)) || (! gen.keyed(b, t, &F1)) || (std::abs(F1-F0) > df)) {
+      continue;
+    }
+    // Bin of the carrier, the spectrum is centered at the BFO frequency in FFT order
+    int bin = std::round((F1-Fbfo)/df);
+    if (std::abs(bin) >= N/2) { continue; }
+    double peak = 0;
+    for (int i=bin-2; i<=bin+2; i++) { peak = std::max(peak, psd[(i+N) % N]); }
+    keyed++;
+    if (10*std::log10(peak/median) < snr) { missed++; }
+  }
+}
+
+/** Measures the amplitude of beacon @c idx of a copy of @c gen within its first keyed element by
+ * correlating the signal with the carrier. The beacon must neither drift nor fade. Returns
+ * @c false if the level deviates more than @c tolerance dB from the level of the beacon. */
+template <class Signal>
+static bool
+checkLevel(QRSSGenerator gen, size_t idx, double tolerance) {
+  const QRSSGenerator::Beacon &beacon = gen.beacon(idx);
+  double unitSamples = beacon.dotLength*gen.sampleRate(), F = 0;
+  size_t unit = 0;
+  while (! gen.keyed(idx, (unit+0.5)*beacon.dotLength, &F)) { unit++; }
+  size_t first = std::ceil(unit*unitSamples), n = size_t((unit+1)*unitSamples)-first;
+  std::vector<Signal> signal(std::max(first, n));
+  if (first) { gen.generate(signal.data(), first); }
+  gen.generate(signal.data(), n);
+
+  double w = 2*M_PI*F/gen.sampleRate();
+  std::complex<double> sum = 0;
+  for (size_t i=0; i<n; i++) {
+    sum += std::complex<double>(signal[i])*std::polar(1.0, -w*(first+i));
+  }
+  // A real carrier splits into two complex ones of half the amplitude
+  double level = 20*std::log10((std::is_same<Signal, float>::value ? 2 : 1)*std::abs(sum)/n);
+  printf(" level: beacon %zu at %.2f dBFS, expected %.2f dBFS\n", idx, level, beacon.level);
+  if (std::abs(level-beacon.level) > tolerance) {
+    printf("FAIL: Beacon level deviates more than %g dB.\n", tolerance);
+    return false;
+  }
+  return true;
+}
+
+/** Decodes all columns of the history at full and at reduced time resolution and compares them
+ * against the quantized spectra @c columns. */
+static bool
+checkHistory(SpectrumHistory &history, const std::vector<uint8_t> &columns, size_t bins) {
+  size_t n = bins ? columns.size()/bins : 0;
+  if ((0 == n) || (history.numColumns() != n) || (history.numBins() != bins)) {
+    printf("FAIL: History holds %zu columns of %zu bins, expected %zu of %zu.\n",
+           history.numColumns(), history.numBins(), n, bins);
+    return false;
+  }
+
+  // Full resolution and 8 columns averaged per decoded column
+  size_t maxColumns[2] = { n, std::max(size_t(1), n/8) };
+  for (size_t k=0; k<2; k++) {
+    SpectrumHistory::Range range = history.decode(0, n, maxColumns[k]);
+    // Average the quantized columns pairwise like the history does
+    std::vector<uint8_t> expected(columns);
+    size_t m = n;
+    for (size_t step=1; step<range.step; step*=2) {
+      m /= 2;
+      for (size_t c=0; c<m; c++) {
+        for (size_t i=0; i<bins; i++) {
+          expected[c*bins+i] = (expected[2*c*bins+i] + expected[(2*c+1)*bins+i] + 1)/2;
+        }
+      }
+    }
+    // Compare complete columns
+    size_t mismatches = 0;
+    for (size_t j=0; j<std::min(m, range.columns)*bins; j++) {
+      if (! (history.dequantize(expected[j]) == range.data[j])) { mismatches++; }
+    }
+    printf(" history: %zu columns of %zu averaged, %zu mismatches, %zu bytes\n",
+           range.columns, range.step, mismatches, history.memoryUsage());
+    if (mismatches || (range.columns < m)) {
+      printf("FAIL: History does not reproduce the spectra.\n");
+      return false;
+    }
+  }
+
+  // The spectra are noisy, still the complete chunks must shrink
+  size_t usage = history.memoryUsage(), raw = history.rawSize();
+  printf(" history: %zu of %zu bytes uncompressed (%.3f)\n", usage, raw, double(usage)/raw);
+  if (usage >= raw) {
+    printf("FAIL: History compression does not shrink the spectra.\n");
+    return false;
+  }
+  return true;
+}
+
+
+/** Collects the blocks of a source, hence the input of a chain can be generated before the
+ * chain is timed. */
+template <class Scalar>
+class Capture: public SinkBase
+{
+public:
+  /** Constructor, captures up to @c nblocks blocks of @c bufferSize samples. */
+  Capture(size_t nblocks, size_t bufferSize)
+    : SinkBase(), _blocks(), _count(0)
+  {
+    for (size_t i=0; i<nblocks; i++) {
+      _blocks.push_back(Buffer<Scalar>(bufferSize));
+    }
+  }
+
+  /** Returns the number of captured blocks. */
+  size_t count() const { return _count; }
+  /** Returns the specified captured block. */
+  const Buffer<Scalar> &block(size_t idx) const { return _blocks[idx]; }
+  /** Discards the captured blocks. */
+  void clear() { _count = 0; }
+
+  /** Unused, the block size is fixed. */
+  virtual void config(const Config &src_cfg) {
+    // pass...
+  }
+
+  /** Copies the buffer into the next block. */
+  virtual void handleBuffer(const RawBuffer &buffer, bool allow_overwrite) {
+    if (_count == _blocks.size()) { return; }
+    memcpy(_blocks[_count].data(), buffer.data(), buffer.bytesLen());
+    _count++;
+  }
+
+protected:
+  /** The captured blocks. */
+  std::vector< Buffer<Scalar> > _blocks;
+  /** Number of captured blocks. */
+  size_t _count;
+};
+
+
+/** Passes captured blocks to the connected sinks. */
+template <class Scalar>
+class Replay: public Source
+{
+public:
+  /** Constructor. */
+  Replay(double sampleRate, size_t bufferSize) : Source() {
+    this->setConfig(Config(Config::typeId<Scalar>(), sampleRate, bufferSize, 1));
+  }
+
+  /** Sends the given block. */
+  void play(const Buffer<Scalar> &block) {
+    this->send(block);
+  }
+};
+
+
+/** Provides recorded PSD frames, e.g. to feed them into a SpectrumHistory. */
+class Frames: public gui::SpectrumProvider
+{
+public:
+  /** Constructor. */
+  Frames(size_t bins, double sampleRate)
+    : gui::SpectrumProvider(), _psd(bins), _sampleRate(sampleRate) { }
+
+  /** Implements the SpectrumProvider interface. */
+  bool isInputReal() const { return false; }
+  /** Implements the SpectrumProvider interface. */
+  double sampleRate() const { return _sampleRate; }
+  /** Implements the SpectrumProvider interface. */
+  size_t fftSize() const { return _psd.size(); }
+  /** Implements the SpectrumProvider interface. */
+  const Buffer<double> &spectrum() const { return _psd; }
+
+  /** Sets the current spectrum and signals the update. */
+  void play(const double *psd) {
+    for (size_t i=0; i<_psd.size(); i++) { _psd[i] = psd[i]; }
+    emit spectrumUpdated();
+  }
+
+protected:
+  /** The current spectrum. */
+  Buffer<double> _psd;
+  /** The sample rate. */
+  double _sampleRate;
+};
+
+
+/** Runs the chain source -> AGC -> QRSS for the given number of blocks, collects the PSD
+ * frames in dB into @c result and the resource usage into @c usage. Returns @c false if the
+ * level, detection or history check fails.
+ *
+ * The input is generated chunk by chunk before the chunk is processed, only the processing
+ * (AGC and QRSS node) is timed. The spectra are checked after the chain has finished. */
+template <class Scalar>
+bool
+runChain(size_t nblocks, Golden &result, Baseline &usage) {
+  GeneratorSource<Scalar> src(16e3, 256, false, -60, 1);
+  QRSSGenerator &gen = src.generator();
+  gen.addBeacon(QRSSGenerator::Beacon(QRSSGenerator::MODE_CW, 775, "QRSS", 3, -40));
+  gen.addBeacon(QRSSGenerator::Beacon(QRSSGenerator::MODE_FSK_CW, 800, "QRSS", 3, -45, 5, 1));
+  gen.addBeacon(QRSSGenerator::Beacon(QRSSGenerator::MODE_DFCW, 825, "QRSS", 3, -50, 5, 0,
+                                      20, 0.8));
+  // The CW beacon neither drifts nor fades
+  typedef typename std::conditional<std::is_same<Scalar, Sample>::value,
+      float, std::complex<float> >::type Signal;
+  bool levelOk = checkLevel<Signal>(gen, 0, 0.5);
+
+  Capture<Scalar> capture(REGRESS_CHUNK_BLOCKS, 256);
+  src.connect(&capture, true);
+
+  Replay<Scalar> replay(16e3, 256);
+  AGC<Scalar> agc(0.1, 10e3*SampleTraits<Sample>::fullScale()/(1<<15));
+  agc.enable(true);
+  QRSS<Sample> qrss(800, 3, 100);
+  replay.connect(&agc, true);
+  agc.connect(&qrss, true);
+
+  // Only copy the spectra within the timed section
+  std::vector<double> psd, times;
+  size_t sent = 0;
+  QObject::connect(&qrss, &gui::SpectrumProvider::spectrumUpdated, [&qrss, &psd, &times, &sent]() {
+    const Buffer<double> &spectrum = qrss.spectrum();
+    for (size_t i=0; i<spectrum.size(); i++) { psd.push_back(spectrum[i]); }
+    // The sinks are connected directly, hence the spectrum ends within the last block
+    times.push_back(sent*256/qrss.sampleRate());
+  });
+
+  double wall = 0, cpu = 0;
+  for (size_t done=0; done<nblocks;) {
+    // Generate the next chunk of input
+    capture.clear();
+    size_t n = std::min(size_t(REGRESS_CHUNK_BLOCKS), nblocks-done);
+    for (size_t i=0; (i<n) && src.next(); i++) { }
+    n = capture.count();
+    if (0 == n) { break; }
+    // Process it
+    double cpu0 = cpuTime();
+    int64_t wall0 = monotonicNs();
+    for (size_t i=0; i<n; i++) {
+      sent++; replay.play(capture.block(i));
+    }
+    cpu += cpuTime()-cpu0;
+    wall += 1e-9*(monotonicNs()-wall0);
+    done += n;
+  }
+  double minutes = nblocks*256/(60*16e3);
+  usage.wallTime = wall/minutes;
+  usage.cpuTime = cpu/minutes;
+  usage.peakRSS = peakRSS();
+
+  // Check the spectra
+  size_t bins = qrss.fftSize(), nframes = times.size();
+  size_t subsample = qrss.sampleRate()/qrss.width();
+  double window = (bins*subsample + 256)/qrss.sampleRate();
+  double df = qrss.sampleRate()/(subsample*bins);
+  Frames frames(bins, qrss.sampleRate());
+  SpectrumHistory history(&frames);
+  std::vector<uint8_t> quantized;
+  size_t keyed = 0, missed = 0;
+  result.bins = bins;
+  result.frames.resize(psd.size());
+  for (size_t f=0; f<nframes; f++) {
+    const double *frame = psd.data() + f*bins;
+    for (size_t i=0; i<bins; i++) {
+      result.frames[f*bins+i] = 10*std::log10(frame[i]+1e-30);
+      quantized.push_back(history.quantize(frame[i]));
+    }
+    frames.play(frame);
+    checkDetection(gen, frames.spectrum(), qrss.Fbfo(), df, window, times[f], 10, keyed, missed);
+  }
+
+  printf(" detection: %zu of %zu keyed beacons missed\n", missed, keyed);
+  bool ok = levelOk;
+  if ((0 == keyed) || missed) {
+    printf("FAIL: Beacons not detected in the spectra.\n"); ok = false;
+  }
+  return checkHistory(history, quantized, bins) && ok;
+}
+
+
+static void
+usage(const char *name) {
+  fprintf(stderr,
+          "Usage: %s --chain audio|iq [OPTIONS]\n"
+          " --golden FILE    Compare the spectra against the golden file.\n"
+          " --baseline FILE  Compare the resource usage against the baseline file.\n"
+          " --minutes M      Minutes of signal to process (default 10).\n"
+          " --tolerance DB   Max. deviation of the PSD from the golden spectra (default 1).\n"
+          " --max-time F     Max. wall and CPU time relative to the baseline (default 1.25).\n"
+          " --max-rss F      Max. peak RSS relative to the baseline (default 1.25).\n"
+          " --record         (Re-) Record the given golden and baseline files.\n", name);
+}
+
+
+int main(int argc, char *argv[])
+{
+  std::string chain, golden, baseline;
+  double minutes = 10, tolerance = 1, maxTime = 1.25, maxRSS = 1.25;
+  bool record = false;
+  for (int i=1; i<argc; i++) {
+    std::string arg = argv[i];
+    if (("--chain" == arg) && (i+1 < argc)) { chain = argv[++i]; }
+    else if (("--golden" == arg) && (i+1 < argc)) { golden = argv[++i]; }
+    else if (("--baseline" == arg) && (i+1 < argc)) { baseline = argv[++i]; }
+    else if (("--minutes" == arg) && (i+1 < argc)) { minutes = atof(argv[++i]); }
+    else if (("--tolerance" == arg) && (i+1 < argc)) { tolerance = atof(argv[++i]); }
+    else if (("--max-time" == arg) && (i+1 < argc)) { maxTime = atof(argv[++i]); }
+    else if (("--max-rss" == arg) && (i+1 < argc)) { maxRSS = atof(argv[++i]); }
+    else if ("--record" == arg) { record = true; }
+    else { usage(argv[0]); return 2; }
+  }
+  if ((("audio" != chain) && ("iq" != chain)) || (record && golden.empty() && baseline.empty())) {
+    usage(argv[0]); return 2;
+  }
+
+  // Process signal
+  Golden result; Baseline resources;
+  size_t nblocks = minutes*60*16e3/256;
+  bool checksOk;
+  if ("audio" == chain) { checksOk = runChain<Sample>(nblocks, result, resources); }
+  else { checksOk = runChain< std::complex<Sample> >(nblocks, result, resources); }
+  printf("Chain %s (%s), %g min of signal, %zu frames:\n"
+         " wall time: %.3f s/min\n cpu time:  %.3f s/min\n peak RSS:  %.0f kB\n",
+         chain.c_str(), SampleTraits<Sample>::name(), minutes, result.numFrames(),
+         resources.wallTime, resources.cpuTime, resources.peakRSS);
+
+  // Record golden spectra and baseline if requested
+  if (record) {
+    if ((! golden.empty()) && (! result.write(golden))) {
+      fprintf(stderr, "Can not write golden file '%s'.\n", golden.c_str());
+      return 1;
+    }
+    if ((! baseline.empty()) && (! resources.write(baseline))) {
+      fprintf(stderr, "Can not write baseline file '%s'.\n", baseline.c_str());
+      return 1;
+    }
+    if (! golden.empty()) { printf("Recorded golden file '%s'.\n", golden.c_str()); }
+    if (! baseline.empty()) { printf("Recorded baseline '%s'.\n", baseline.c_str()); }
+    return checksOk ? 0 : 1;
+  }
+
+  bool ok = checksOk;
+  // Compare spectra, a given but missing golden file is an error
+  if (! golden.empty()) {
+    Golden ref;
+    if (! ref.read(golden)) {
+      printf("FAIL: Can not read golden file '%s', record it with --record.\n", golden.c_str());
+      return 1;
+    }
+    size_t nframes = ref.numFrames();
+    if ((ref.bins != result.bins) || (nframes != result.numFrames())) {
+      printf("FAIL: Spectrum layout changed: %zu frames of %u bins, expected %zu of %u.\n",
+             result.numFrames(), result.bins, ref.numFrames(), ref.bins);
+      return 1;
+    }
+    size_t outliers = 0; double maxDev = 0;
+    for (size_t i=0; i<nframes*ref.bins; i++) {
+      double dev = std::abs(result.frames[i]-ref.frames[i]);
+      maxDev = std::max(maxDev, dev);
+      if (dev > tolerance) { outliers++; }
+    }
+    printf(" max. PSD deviation: %.3f dB (%zu bins above %g dB)\n", maxDev, outliers, tolerance);
+    if (outliers) { printf("FAIL: PSD deviates from the golden spectra.\n"); ok = false; }
+  } else {
+    printf(" golden spectra: not compared\n");
+  }
+
+  // Compare resource usage, a given but missing baseline is an error
+  if (! baseline.empty()) {
+    Baseline base;
+    if (! base.read(baseline)) {
+      printf("FAIL: Can not read baseline '%s', record it with --record.\n", baseline.c_str());
+      return 1;
+    }
+    if (resources.wallTime > maxTime*base.wallTime) {
+      printf("FAIL: Wall time %.3f s/min exceeds %.3f s/min (baseline %.3f).\n",
+             resources.wallTime, maxTime*base.wallTime, base.wallTime);
+      ok = false;
+    }
+    if (resources.cpuTime > maxTime*base.cpuTime) {
+      printf("FAIL: CPU time %.3f s/min exceeds %.3f s/min (baseline %.3f).\n",
+             resources.cpuTime, maxTime*base.cpuTime, base.cpuTime);
+      ok = false;
+    }
+    if (resources.peakRSS > maxRSS*base.peakRSS) {
+      printf("FAIL: Peak RSS %.0f kB exceeds %.0f kB (baseline %.0f).\n",
+             resources.peakRSS, maxRSS*base.peakRSS, base.peakRSS);
+      ok = false;
+    }
+  } else {
+    printf(" baseline: not compared\n");
+  }
+
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,256 @@
+#ifndef __SDR_QRSS_AUDIOINPUT_HH__
+#define __SDR_QRSS_AUDIOINPUT_HH__
+
+#include <node.hh>
+#include <queue.hh>
+#include <logger.hh>
+#include <portaudio.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <time.h>
+#include "sample.hh"
+#include "spscring.hh"
+#include "realtime.hh"
+
+
+/** Number of blocks of an @c AudioInput. */
+#define AUDIOINPUT_BLOCKS 8
+
+namespace sdr {
+
+
+/** Event driven sound card input.
+ *
+ * In contrast to @c PortSource, this source does not poll the device from the idle loop of the
+ * queue. The PortAudio callback collects the frames into blocks and hands each complete block
+ * over to a forwarder thread, which posts it to the queue. Hence the queue thread only wakes up
+ * if a block is available and sleeps otherwise. The blocks are passed to the connected sinks from
+ * within the queue thread, so sinks should be connected directly and must not keep a reference
+ * to the blocks.
+ *
+ * The callback neither locks nor allocates: It takes a free block from a lock-free ring of
+ * block indices, copies the frames and passes the index of a complete block through a second
+ * ring to the forwarder thread. @c handleBuffer returns the index to the free ring once the
+ * sinks have processed the block. Hence every block is owned by exactly one of the callback,
+ * the forwarder, the queue or the free ring.
+ *
+ * The time between completing a block and its processing by the queue thread (wakeup latency)
+ * is tracked.
+ *
+ * @c Scalar is either a real sample type (mono input) or a complex one (stereo IQ input). */
+template <class Scalar>
+class AudioInput: public Source, public SinkBase
+{
+public:
+  /** Constructor.
+   * @param sampleRate Specifies the sample rate in Hz.
+   * @param bufferSize Specifies the number of frames per block.
+   * @param device Specifies the input device index, -1 selects the default device. */
+  AudioInput(double sampleRate, size_t bufferSize, int device=-1)
+    : Source(), SinkBase(), _bufferSize(bufferSize), _blocks(), _stamps(AUDIOINPUT_BLOCKS, 0),
+      _free(AUDIOINPUT_BLOCKS), _posted(AUDIOINPUT_BLOCKS), _current(AUDIOINPUT_BLOCKS),
+      _fill(0), _started(0), _dropped(0), _latencySum(0), _latencyMax(0), _latencyCount(0), _stream(0),
+      _forwarding(false)
+  {
+    for (size_t i=0; i<AUDIOINPUT_BLOCKS; i++) {
+      _blocks.push_back(Buffer<Scalar>(bufferSize));
+      _free.put(&i, 1);
+    }
+    sem_init(&_ready, 0, 0);
+
+    if (0 > device) { device = Pa_GetDefaultInputDevice(); }
+    PaStreamParameters params;
+    params.device = device;
+    params.channelCount = channels((Scalar *)0);
+    params.sampleFormat = SampleTraits<Sample>::paFormat();
+    params.suggestedLatency = 0;
+    params.hostApiSpecificStreamInfo = 0;
+    if (const PaDeviceInfo *info = Pa_GetDeviceInfo(device)) {
+      params.suggestedLatency = info->defaultLowInputLatency;
+    }
+
+    PaError err = Pa_OpenStream(&_stream, &params, 0, sampleRate, bufferSize, paNoFlag,
+                                &AudioInput<Scalar>::_callback, this);
+    if (paNoError != err) {
+      LogMessage msg(LOG_ERROR);
+      msg << "Can not open audio input device " << device << ": " << Pa_GetErrorText(err);
+      Logger::get().log(msg);
+      _stream = 0;
+    }
+
+    this->setConfig(Config(Config::typeId<Scalar>(), sampleRate, bufferSize, _blocks.size()));
+    Queue::get().addStart(this, &AudioInput<Scalar>::start);
+    Queue::get().addStop(this, &AudioInput<Scalar>::stop);
+  }
+
+  /** Destructor. */
+  virtual ~AudioInput() {
+    Queue::get().remStart(this);
+    Queue::get().remStop(this);
+    stop();
+    if (0 != _stream) { Pa_CloseStream(_stream); }
+    sem_destroy(&_ready);
+  }
+
+  /** Starts the forwarder thread and the input stream, called on the start of the queue. */
+  void start() {
+    if ((0 == _stream) || _forwarding) { return; }
+    _dropped = 0; _latencySum = 0; _latencyMax = 0; _latencyCount = 0;
+    // Drop a partial block and the blocks completed before the last stop
+    _fill = 0; _started = monotonicNs();
+    _forwarding = true;
+    pthread_create(&_thread, 0, &AudioInput<Scalar>::_forwarder_main, this);
+    Pa_StartStream(_stream);
+  }
+
+  /** Stops the input stream and the forwarder thread, called on the stop of the queue. The
+   * blocks still held by the callback or the forwarder are kept until the next start, the blocks
+   * posted to the queue return via @c handleBuffer. */
+  void stop() {
+    if (! _forwarding) { return; }
+    Pa_StopStream(_stream);
+    _forwarding = false;
+    sem_post(&_ready);
+    pthread_join(_thread, 0);
+
+    LogMessage msg(LOG_DEBUG);
+    msg << "Audio input stopped:" << std::endl
+        << " Dropped blocks: " << _dropped << std::endl
+        << " Mean wakeup latency: " << meanWakeupLatency()*1e3 << "ms" << std::endl
+        << " Max. wakeup latency: " << maxWakeupLatency()*1e3 << "ms";
+    Logger::get().log(msg);
+  }
+
+  /** Waits until the queue processed all blocks posted before @c stop, hence the source may be
+   * deleted while the queue keeps running. Must not be called from the queue thread. */
+  void wait() {
+    size_t held = _posted.available() + ((AUDIOINPUT_BLOCKS != _current) ? 1 : 0);
+    while ((_free.available() + held) < AUDIOINPUT_BLOCKS) {
+      struct timespec ts; ts.tv_sec = 0; ts.tv_nsec = 1000000L;
+      nanosleep(&ts, 0);
+    }
+  }
+
+  /** Returns the mean wakeup latency in s. */
+  double meanWakeupLatency() const {
+    if (0 == _latencyCount) { return 0; }
+    return 1e-9*double(_latencySum)/_latencyCount;
+  }
+
+  /** Returns the maximum wakeup latency in s. */
+  double maxWakeupLatency() const {
+    return 1e-9*double(_latencyMax);
+  }
+
+  /** Returns the number of blocks dropped because the queue did not keep up. */
+  size_t dropped() const {
+    return _dropped;
+  }
+
+  /** Unused, this node is not connected to any source. */
+  virtual void config(const Config &src_cfg) {
+    // pass...
+  }
+
+  /** Receives the blocks posted by the forwarder thread within the queue thread, passes them to
+   * the connected sinks and returns them to the callback. */
+  virtual void handleBuffer(const RawBuffer &buffer, bool allow_overwrite) {
+    size_t idx = 0;
+    while ((idx < _blocks.size()) && (_blocks[idx].data() != buffer.data())) { idx++; }
+    if (_blocks.size() == idx) { return; }
+
+    if (_stamps[idx] >= _started) {
+      int64_t latency = monotonicNs()-_stamps[idx];
+      _latencySum += latency; _latencyCount++;
+      _latencyMax = std::max(_latencyMax, latency);
+      this->send(buffer, allow_overwrite);
+    }
+    _free.put(&idx, 1);
+  }
+
+protected:
+  /** Number of input channels for real samples. */
+  static inline int channels(const Sample *) { return 1; }
+  /** Number of input channels for complex samples. */
+  static inline int channels(const std::complex<Sample> *) { return 2; }
+
+  /** The PortAudio callback, collects frames into blocks and hands complete blocks over to the
+   * forwarder thread. */
+  static int _callback(const void *input, void *output, unsigned long frames,
+                       const PaStreamCallbackTimeInfo *timeInfo,
+                       PaStreamCallbackFlags statusFlags, void *ctx)
+  {
+    AudioInput<Scalar> *self = reinterpret_cast<AudioInput<Scalar> *>(ctx);
+    const Scalar *in = reinterpret_cast<const Scalar *>(input);
+    while (frames) {
+      // Drop frames if all blocks are still in use by the queue
+      if ((AUDIOINPUT_BLOCKS == self->_current) && (0 == self->_free.take(&self->_current, 1))) {
+        self->_dropped++;
+        return paContinue;
+      }
+      Scalar *block = reinterpret_cast<Scalar *>(self->_blocks[self->_current].data());
+      size_t n = std::min(size_t(frames), self->_bufferSize-self->_fill);
+      std::copy(in, in+n, block+self->_fill);
+      in += n; frames -= n; self->_fill += n;
+      // Hand the complete block over and wake up the forwarder
+      if (self->_bufferSize == self->_fill) {
+        self->_stamps[self->_current] = monotonicNs();
+        self->_posted.put(&self->_current, 1);
+        sem_post(&self->_ready);
+        self->_current = AUDIOINPUT_BLOCKS; self->_fill = 0;
+      }
+    }
+    return paContinue;
+  }
+
+  /** The main loop of the forwarder thread, posts the complete blocks to the queue. */
+  static void *_forwarder_main(void *ctx) {
+    AudioInput<Scalar> *self = reinterpret_cast<AudioInput<Scalar> *>(ctx);
+    size_t idx;
+    while (self->_forwarding) {
+      sem_wait(&self->_ready);
+      while (self->_forwarding && self->_posted.take(&idx, 1)) {
+        Queue::get().send(self->_blocks[idx], self);
+      }
+    }
+    return 0;
+  }
+
+protected:
+  /** The number of frames per block. */
+  size_t _bufferSize;
+  /** The block buffers. */
+  std::vector< Buffer<Scalar> > _blocks;
+  /** Completion time of each block. */
+  std::vector<int64_t> _stamps;
+  /** Indices of the free blocks, returned by @c handleBuffer and taken by the callback. */
+  SPSCRing<size_t> _free;
+  /** Indices of the complete blocks, put by the callback and taken by the forwarder. */
+  SPSCRing<size_t> _posted;
+  /** Index of the block being filled or @c AUDIOINPUT_BLOCKS if there is none. */
+  size_t _current;
+  /** Number of frames in the block being filled. */
+  size_t _fill;
+  /** Time of the last start, earlier blocks are not passed on. */
+  int64_t _started;
+  /** Number of dropped blocks. */
+  size_t _dropped;
+  /** Sum of the wakeup latencies in ns. */
+  int64_t _latencySum;
+  /** Maximum wakeup latency in ns. */
+  int64_t _latencyMax;
+  /** Number of measured wakeup latencies. */
+  size_t _latencyCount;
+  /** The PortAudio stream. */
+  PaStream *_stream;
+  /** If @c true, the forwarder thread is running. */
+  volatile bool _forwarding;
+  /** Counts the complete blocks not yet taken by the forwarder. */
+  sem_t _ready;
+  /** The forwarder thread. */
+  pthread_t _thread;
+};
+
+}
+
+#endif // __SDR_QRSS_AUDIOINPUT_HH__
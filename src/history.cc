@@ -0,0 +1,372 @@
+#include "history.hh"
+#include <QMutexLocker>
+#include <cmath>
+#include <limits>
+
+using namespace sdr;
+
+/** Number of columns per chunk. */
+#define HISTORY_CHUNK_COLUMNS 64
+/** Number of levels of time resolution, level l averages 2^l columns. */
+#define HISTORY_LEVELS 8
+/** Number of values sharing a Rice parameter. */
+#define HISTORY_GROUP 16
+/** Rice parameter marking a group of zeros. */
+#define HISTORY_ZERO_GROUP 15
+
+/** Chunk formats, stored in the first byte of the compressed data. */
+typedef enum {
+  CHUNK_RAW = 0,  ///< Uncompressed columns.
+  CHUNK_RICE = 1  ///< Rice coded deltas.
+} ChunkFormat;
+
+
+/** Appends bits to a byte vector, MSB first. */
+class BitWriter {
+public:
+  /** Constructor. */
+  BitWriter(std::vector<uint8_t> &out) : _out(out), _bits(0), _count(0) { }
+  /** Appends the lowest @c n bits of @c value. */
+  inline void put(uint32_t value, size_t n) {
+    for (size_t i=n; i>0; i--) { bit((value>>(i-1)) & 1); }
+  }
+  /** Appends a single bit. */
+  inline void bit(uint32_t b) {
+    _bits = (_bits<<1) | b;
+    if (8 == ++_count) { _out.push_back(_bits); _bits = 0; _count = 0; }
+  }
+  /** Flushes the remaining bits. */
+  inline void flush() {
+    if (_count) { _out.push_back(_bits<<(8-_count)); _bits = 0; _count = 0; }
+  }
+protected:
+  std::vector<uint8_t> &_out;
+  uint8_t _bits;
+  size_t _count;
+};
+
+/** Reads bits from a byte array, MSB first. Reads past the end return zeros. */
+class BitReader {
+public:
+  /** Constructor. */
+  BitReader(const uint8_t *data, size_t size) : _data(data), _size(size), _pos(0) { }
+  /** Reads @c n bits. */
+  inline uint32_t get(size_t n) {
+    uint32_t value = 0;
+    for (size_t i=0; i<n; i++) { value = (value<<1) | bit(); }
+    return value;
+  }
+  /** Reads a single bit. */
+  inline uint32_t bit() {
+    size_t byte = _pos>>3, shift = 7-(_pos&7);
+    if (byte >= _size) { return 0; }
+    _pos++;
+    return (_data[byte]>>shift) & 1;
+  }
+protected:
+  const uint8_t *_data;
+  size_t _size;
+  size_t _pos;
+};
+
+/** Maps a signed 8bit delta to 0, 1, 2, ... for 0, -1, 1, ... */
+static inline uint8_t
+zigzag(uint8_t delta) {
+  return uint8_t((delta<<1) ^ (int8_t(delta)>>7));
+}
+
+/** Inverse of @c zigzag. */
+static inline uint8_t
+unzigzag(uint8_t value) {
+  return uint8_t((value>>1) ^ -(value&1));
+}
+
+
+/* ********************************************************************************************* *
+ * Implementation of SpectrumHistory
+ * ********************************************************************************************* */
+SpectrumHistory::SpectrumHistory(gui::SpectrumProvider *spectrum, size_t budget, float minDb,
+                                 float stepDb, QObject *parent)
+  : QObject(parent), _spectrum(spectrum), _budget(budget), _usage(0), _reserved(0),
+    _minDb(minDb), _stepDb(stepDb), _bins(0), _columns(0), _levels(HISTORY_LEVELS), _column(), _lock()
+{
+  clear();
+  // The spectrum is recorded within the processing thread, before it gets overridden
+  QObject::connect(_spectrum, SIGNAL(spectrumUpdated()), this, SLOT(onSpectrumUpdated()),
+                   Qt::DirectConnection);
+  QObject::connect(_spectrum, SIGNAL(spectrumConfigured()), this, SLOT(onSpectrumConfigured()),
+                   Qt::DirectConnection);
+}
+
+SpectrumHistory::~SpectrumHistory() {
+  // pass...
+}
+
+size_t
+SpectrumHistory::budget() const {
+  return _budget;
+}
+
+void
+SpectrumHistory::setBudget(size_t bytes) {
+  QMutexLocker locker(&_lock);
+  _budget = bytes;
+  evict();
+}
+
+size_t
+SpectrumHistory::memoryUsage() const {
+  QMutexLocker locker(&_lock);
+  return _usage + _reserved;
+}
+
+size_t
+SpectrumHistory::rawSize() const {
+  QMutexLocker locker(&_lock);
+  size_t size = _reserved;
+  for (size_t l=0; l<_levels.size(); l++) {
+    std::map<size_t, Chunk>::const_iterator item = _levels[l].chunks.begin();
+    for (; item != _levels[l].chunks.end(); item++) {
+      size += item->second.columns*_bins;
+    }
+  }
+  return size;
+}
+
+size_t
+SpectrumHistory::numBins() const {
+  QMutexLocker locker(&_lock);
+  return _bins;
+}
+
+size_t
+SpectrumHistory::numColumns() const {
+  QMutexLocker locker(&_lock);
+  return _columns;
+}
+
+size_t
+SpectrumHistory::firstColumn() const {
+  QMutexLocker locker(&_lock);
+  const Level &level = _levels[0];
+  if (level.chunks.empty()) { return level.openFirst; }
+  return level.chunks.begin()->first;
+}
+
+void
+SpectrumHistory::onSpectrumUpdated() {
+  const Buffer<double> &psd = _spectrum->spectrum();
+  QMutexLocker locker(&_lock);
+  if (psd.size() != _bins) { return; }
+  // Quantize to 8bit dB
+  for (size_t i=0; i<_bins; i++) {
+    _column[i] = quantize(psd[i]);
+  }
+  addColumn(0, _column.data());
+  _columns++;
+}
+
+void
+SpectrumHistory::onSpectrumConfigured() {
+  QMutexLocker locker(&_lock);
+  clear();
+}
+
+void
+SpectrumHistory::clear() {
+  _bins = _spectrum->fftSize();
+  _columns = 0; _usage = 0; _reserved = 0;
+  _column.resize(_bins);
+  for (size_t l=0; l<_levels.size(); l++) {
+    _levels[l].chunks.clear();
+    _levels[l].open.clear();
+    _levels[l].open.reserve(HISTORY_CHUNK_COLUMNS*_bins);
+    _levels[l].openColumns = 0;
+    _levels[l].openFirst = 0;
+    _levels[l].acc.assign(_bins, 0);
+    _levels[l].accCount = 0;
+    // The open chunk and the accumulator are allocated up-front
+    _reserved += _levels[l].open.capacity() + _levels[l].acc.size()*sizeof(uint16_t);
+  }
+}
+
+void
+SpectrumHistory::addColumn(size_t l, const uint8_t *column) {
+  Level &level = _levels[l];
+  level.open.insert(level.open.end(), column, column+_bins);
+  level.openColumns++;
+
+  // Close chunk if complete
+  if (HISTORY_CHUNK_COLUMNS == level.openColumns) {
+    Chunk &chunk = level.chunks[level.openFirst];
+    chunk.columns = level.openColumns;
+    chunk.lastUse = _columns;
+    compress(level.open, level.openColumns, chunk.data);
+    _usage += chunk.data.size();
+    level.openFirst += level.openColumns;
+    level.openColumns = 0;
+    level.open.clear();
+    evict();
+  }
+
+  // Average pairs of columns into the next level
+  if ((l+1) == _levels.size()) { return; }
+  for (size_t i=0; i<_bins; i++) { level.acc[i] += column[i]; }
+  if (2 == ++level.accCount) {
+    for (size_t i=0; i<_bins; i++) {
+      _column[i] = uint8_t((level.acc[i]+1)/2); level.acc[i] = 0;
+    }
+    level.accCount = 0;
+    addColumn(l+1, _column.data());
+  }
+}
+
+void
+SpectrumHistory::compress(const std::vector<uint8_t> &raw, size_t columns,
+                          std::vector<uint8_t> &out) const
+{
+  // Zigzag coded delta to the previous column (to the previous bin within the first column)
+  size_t n = columns*_bins;
+  std::vector<uint8_t> delta(n);
+  for (size_t j=0; j<n; j++) {
+    uint8_t prev = (j>=_bins) ? raw[j-_bins] : ((j>0) ? raw[j-1] : 0);
+    delta[j] = zigzag(uint8_t(raw[j]-prev));
+  }
+
+  // Rice code groups of deltas, each with the parameter k of the shortest code. Groups of zeros
+  // (e.g., a steady spectrum) take 4 bits only.
+  out.clear(); out.reserve(n+1);
+  out.push_back(CHUNK_RICE);
+  BitWriter writer(out);
+  for (size_t g=0; g<n; g+=HISTORY_GROUP) {
+    size_t len = std::min(size_t(HISTORY_GROUP), n-g);
+    const uint8_t *values = &delta[g];
+    size_t k = HISTORY_ZERO_GROUP, bestBits = 0;
+    uint8_t any = 0;
+    for (size_t i=0; i<len; i++) { any |= values[i]; }
+    for (size_t kk=0; any && (kk<=8); kk++) {
+      size_t bits = 0;
+      for (size_t i=0; i<len; i++) { bits += (values[i]>>kk) + 1 + kk; }
+      if ((HISTORY_ZERO_GROUP == k) || (bits < bestBits)) { k = kk; bestBits = bits; }
+    }
+    writer.put(k, 4);
+    if (HISTORY_ZERO_GROUP == k) { continue; }
+    for (size_t i=0; i<len; i++) {
+      for (size_t q=(values[i]>>k); q>0; q--) { writer.bit(1); }
+      writer.bit(0);
+      writer.put(values[i], k);
+    }
+  }
+  writer.flush();
+
+  // Store raw if the coding does not shrink the chunk (e.g., wide-band noise)
+  if (out.size() >= (n+1)) {
+    out.resize(1); out[0] = CHUNK_RAW;
+    out.insert(out.end(), raw.begin(), raw.begin()+n);
+  }
+  // Release spare capacity, the budget accounts the size only
+  std::vector<uint8_t>(out).swap(out);
+}
+
+void
+SpectrumHistory::decompress(const std::vector<uint8_t> &data, size_t columns,
+                            std::vector<uint8_t> &out) const
+{
+  size_t n = columns*_bins;
+  out.assign(n, 0);
+  if (data.empty()) { return; }
+  if (CHUNK_RAW == data[0]) {
+    std::copy(data.begin()+1, data.begin()+std::min(data.size(), n+1), out.begin());
+    return;
+  }
+
+  BitReader reader(data.data()+1, data.size()-1);
+  for (size_t g=0; g<n; g+=HISTORY_GROUP) {
+    size_t len = std::min(size_t(HISTORY_GROUP), n-g);
+    size_t k = reader.get(4);
+    for (size_t j=g; j<(g+len); j++) {
+      uint8_t value = 0;
+      if (HISTORY_ZERO_GROUP != k) {
+        size_t q = 0;
+        // A valid value has at most 255 leading ones
+        while (reader.bit() && (q < 256)) { q++; }
+        value = uint8_t((q<<k) | reader.get(k));
+      }
+      uint8_t prev = (j>=_bins) ? out[j-_bins] : ((j>0) ? out[j-1] : 0);
+      out[j] = uint8_t(prev + unzigzag(value));
+    }
+  }
+}
+
+void
+SpectrumHistory::evict() {
+  // The open chunks can not be evicted but count against the budget
+  while ((_usage + _reserved) > _budget) {
+    // Find the least recently used chunk. A chunk of level l covers 2^l times the time span of
+    // a full resolution chunk of the same size, hence its age counts only 1/2^l.
+    std::map<size_t, Chunk> *chunks = 0;
+    std::map<size_t, Chunk>::iterator oldest;
+    size_t maxAge = 0;
+    for (size_t l=0; l<_levels.size(); l++) {
+      std::map<size_t, Chunk>::iterator item = _levels[l].chunks.begin();
+      for (; item != _levels[l].chunks.end(); item++) {
+        size_t age = (_columns-item->second.lastUse)>>l;
+        if ((0 == chunks) || (age > maxAge)) {
+          chunks = &_levels[l].chunks; oldest = item; maxAge = age;
+        }
+      }
+    }
+    if (0 == chunks) { return; }
+    _usage -= oldest->second.data.size();
+    chunks->erase(oldest);
+  }
+}
+
+SpectrumHistory::Range
+SpectrumHistory::decode(size_t first, size_t count, size_t maxColumns) {
+  QMutexLocker locker(&_lock);
+  Range range;
+  range.bins = _bins;
+
+  // Select the finest level that fits into maxColumns
+  size_t l = 0;
+  maxColumns = std::max(size_t(1), maxColumns);
+  while (((l+1) < _levels.size()) && (((count+(size_t(1)<<l)-1)>>l) > maxColumns)) {
+    l++;
+  }
+  range.step = (size_t(1)<<l);
+  range.first = (first>>l)<<l;
+  size_t begin = first>>l, end = (first+count+range.step-1)>>l;
+  range.columns = end-begin;
+  range.data.assign(range.columns*_bins, std::numeric_limits<float>::quiet_NaN());
+
+  Level &level = _levels[l];
+  std::vector<uint8_t> raw;
+  size_t col = begin;
+  while (col < end) {
+    const uint8_t *src = 0; size_t srcFirst = 0, srcColumns = 0;
+    if ((col >= level.openFirst) && (col < level.openFirst+level.openColumns)) {
+      src = level.open.data(); srcFirst = level.openFirst; srcColumns = level.openColumns;
+    } else {
+      // Find chunk containing col
+      std::map<size_t, Chunk>::iterator item = level.chunks.upper_bound(col);
+      if (level.chunks.begin() != item) {
+        item--;
+        if (col < (item->first+item->second.columns)) {
+          item->second.lastUse = _columns;
+          decompress(item->second.data, item->second.columns, raw);
+          src = raw.data(); srcFirst = item->first; srcColumns = item->second.columns;
+        }
+      }
+    }
+    if (0 == src) { col++; continue; }
+    // Dequantize the columns of the chunk within the range
+    for (; (col < end) && (col < srcFirst+srcColumns); col++) {
+      const uint8_t *in = src + (col-srcFirst)*_bins;
+      float *out = range.data.data() + (col-begin)*_bins;
+      for (size_t i=0; i<_bins; i++) { out[i] = dequantize(in[i]); }
+    }
+  }
+
+  return range;
+}
@@ -0,0 +1,167 @@
+#ifndef __SDR_QRSS_HISTORY_HH__
+#define __SDR_QRSS_HISTORY_HH__
+
+#include <QObject>
+#include <QMutex>
+#include <gui/spectrum.hh>
+#include <stdint.h>
+#include <vector>
+#include <map>
+#include <cmath>
+#include <algorithm>
+
+
+namespace sdr {
+
+/** Bounded-memory scrollback history of a spectrum provider.
+ *
+ * Each spectrum (column) is quantized to 8bit dB values and collected into chunks of a fixed
+ * number of columns. Complete chunks are compressed: The deltas to the previous column are
+ * Rice coded in groups of 16 values, each group with its own parameter. Chunks that do not
+ * shrink are stored raw. Additionally, the history keeps several levels of reduced time
+ * resolution, where each level averages two columns of the previous one. Hence a zoomed-out view
+ * of a long time range only decodes a few columns.
+ *
+ * The memory used by the history is limited by a budget. It includes the open (uncompressed)
+ * chunks and accumulators of all levels, which are allocated up-front. If exceeded, the least
+ * recently used chunks (of any level) are evicted, where the age of a chunk of reduced
+ * resolution is scaled by the number of columns averaged. Hence the reduced levels outlive the
+ * full resolution data.
+ *
+ * Columns are addressed by their index, counted from the (re-) configuration of the spectrum. */
+class SpectrumHistory: public QObject
+{
+  Q_OBJECT
+
+public:
+  /** A decoded range of the history. */
+  class Range {
+  public:
+    /** Index of the first column. */
+    size_t first;
+    /** Number of full resolution columns per decoded column. */
+    size_t step;
+    /** Number of decoded columns. */
+    size_t columns;
+    /** Number of bins per column. */
+    size_t bins;
+    /** The decoded PSD in dB, column by column. Evicted columns are NaN. */
+    std::vector<float> data;
+  };
+
+public:
+  /** Constructor.
+   * @param spectrum Specifies the spectrum provider to record.
+   * @param budget Specifies the memory budget in bytes.
+   * @param minDb Specifies the lower bound of the quantization range in dB.
+   * @param stepDb Specifies the quantization step in dB.
+   * @param parent Specifies the QObject parent. */
+  SpectrumHistory(gui::SpectrumProvider *spectrum, size_t budget=(64<<20), float minDb=-120,
+                  float stepDb=0.5, QObject *parent=0);
+  /** Destructor. */
+  virtual ~SpectrumHistory();
+
+  /** Returns the memory budget in bytes. */
+  size_t budget() const;
+  /** Sets the memory budget in bytes. */
+  void setBudget(size_t bytes);
+  /** Returns the memory used by the history in bytes. */
+  size_t memoryUsage() const;
+  /** Returns the memory an uncompressed history of the same columns would use in bytes. */
+  size_t rawSize() const;
+
+  /** Returns the number of bins per column. */
+  size_t numBins() const;
+  /** Returns the number of columns recorded. */
+  size_t numColumns() const;
+  /** Returns the index of the oldest column still available at full resolution. */
+  size_t firstColumn() const;
+
+  /** Quantizes a PSD value to the 8bit dB value stored. */
+  inline uint8_t quantize(double psd) const {
+    float q = (10*std::log10(psd+1e-30)-_minDb)/_stepDb + 0.5f;
+    return uint8_t(std::max(0.f, std::min(255.f, q)));
+  }
+  /** Returns the dB value of a quantized value. */
+  inline float dequantize(uint8_t q) const {
+    return _minDb + _stepDb*q;
+  }
+
+  /** Decodes the columns [first, first+count) with at most @c maxColumns columns. The level of
+   * reduced time resolution is chosen accordingly, the coarsest level averages 128 columns. */
+  Range decode(size_t first, size_t count, size_t maxColumns);
+
+protected slots:
+  /** Records the current spectrum. */
+  void onSpectrumUpdated();
+  /** Clears the history. */
+  void onSpectrumConfigured();
+
+protected:
+  /** A compressed chunk of columns. */
+  class Chunk {
+  public:
+    /** Number of columns. */
+    size_t columns;
+    /** The compressed data. */
+    std::vector<uint8_t> data;
+    /** Number of recorded columns at the last use, for LRU eviction. */
+    size_t lastUse;
+  };
+
+  /** One level of time resolution. */
+  class Level {
+  public:
+    /** The complete chunks, indexed by their first column (in units of this level). */
+    std::map<size_t, Chunk> chunks;
+    /** The open (uncompressed) chunk. */
+    std::vector<uint8_t> open;
+    /** Number of columns in the open chunk. */
+    size_t openColumns;
+    /** Index of the first column of the open chunk. */
+    size_t openFirst;
+    /** Accumulator of the column averaged into the next level. */
+    std::vector<uint16_t> acc;
+    /** Number of columns in the accumulator. */
+    size_t accCount;
+  };
+
+  /** Appends a column to the given level. */
+  void addColumn(size_t level, const uint8_t *column);
+  /** Compresses the columns in @c raw. */
+  void compress(const std::vector<uint8_t> &raw, size_t columns, std::vector<uint8_t> &out) const;
+  /** Decompresses a chunk of @c columns columns. */
+  void decompress(const std::vector<uint8_t> &data, size_t columns, std::vector<uint8_t> &out) const;
+  /** Evicts the least recently used chunks until the memory usage is within the budget. */
+  void evict();
+  /** Clears the history. */
+  void clear();
+
+protected:
+  /** The recorded spectrum. */
+  gui::SpectrumProvider *_spectrum;
+  /** The memory budget. */
+  size_t _budget;
+  /** The current memory usage of all complete chunks. */
+  size_t _usage;
+  /** The memory allocated for the open chunks and accumulators of all levels. */
+  size_t _reserved;
+  /** Lower bound of the quantization range. */
+  float _minDb;
+  /** Quantization step. */
+  float _stepDb;
+  /** Number of bins per column. */
+  size_t _bins;
+  /** Number of recorded columns. */
+  size_t _columns;
+  /** The levels of time resolution. */
+  std::vector<Level> _levels;
+  /** Buffer for the quantized column. */
+  std::vector<uint8_t> _column;
+  /** Protects the history against concurrent recording and decoding. */
+  mutable QMutex _lock;
+};
+
+}
+
+#endif // __SDR_QRSS_HISTORY_HH__
@@ -1,4 +1,6 @@
 #include <QApplication>
+#include <QSettings>
+#include <vector>
 #include "receiver.hh"
 #include "mainwindow.hh"
 
@@ -17,10 +19,23 @@ int main(int argc, char *argv[])
   sdr::Logger::get().addHandler(
         new sdr::StreamLogHandler(std::cerr, sdr::LOG_DEBUG));
 
-  Receiver rx;
-  MainWindow win(&rx);
-
-  win.show();
+  // If the sound card is configured to provide more than one channel, run an independent
+  // receiver for each channel.
+  QSettings settings("com.github.hmatuschek", "sdr-qrss");
+  int channels = settings.value("channels", 1).toInt();
+  std::vector<Receiver *> receivers;
+  std::vector<MainWindow *> windows;
+  if (1 < channels) {
+    for (int i=0; i<channels; i++) {
+      receivers.push_back(new Receiver(i));
+    }
+  } else {
+    receivers.push_back(new Receiver());
+  }
+  for (size_t i=0; i<receivers.size(); i++) {
+    windows.push_back(new MainWindow(receivers[i]));
+    windows.back()->show();
+  }
 
   // GO
   app.exec();
@@ -29,6 +44,13 @@ int main(int argc, char *argv[])
   queue.stop();
   queue.wait();
 
+  for (size_t i=0; i<windows.size(); i++) {
+    delete windows[i];
+  }
+  for (size_t i=0; i<receivers.size(); i++) {
+    delete receivers[i];
+  }
+
   PortAudio::terminate();
 
   return 0;
@@ -8,16 +8,36 @@
 #include <QLineEdit>
 #include <QDoubleValidator>
 #include <QCheckBox>
+#include <QTabWidget>
 
 
 MainWindow::MainWindow(Receiver *rx, QWidget *parent) :
-  QMainWindow(parent), _receiver(rx)
+  QMainWindow(parent), _receiver(rx), _tabs(0)
 {
-  setWindowTitle("SDR-QRSS");
+  if (0 <= _receiver->channel()) {
+    setWindowTitle(QString("SDR-QRSS - Channel %1").arg(_receiver->channel()));
+  } else {
+    setWindowTitle("SDR-QRSS");
+  }
 
   QSplitter *splitter = new QSplitter();
-  splitter->addWidget(new sdr::gui::WaterFallView(_receiver->spectrum(), 800,
-                                                  sdr::gui::WaterFallView::RIGHT_LEFT));
+  QWidget *waterfall = new sdr::gui::WaterFallView(_receiver->spectrum(), 800,
+                                                   sdr::gui::WaterFallView::RIGHT_LEFT);
+  if (0 == _receiver->numResolutions()) {
+    splitter->addWidget(waterfall);
+  } else {
+    // One tab per resolution
+    _tabs = new QTabWidget();
+    _tabs->addTab(waterfall, QString("QRSS%1").arg(_receiver->dotLength()));
+    for (size_t i=0; i<_receiver->numResolutions(); i++) {
+      sdr::QRSSResolution *res = _receiver->resolution(i);
+      QString label = QString("QRSS%1").arg(res->dotLength());
+      if (1 != res->hop()) { label += QString(" (hop %1)").arg(res->hop()); }
+      _tabs->addTab(new sdr::gui::WaterFallView(res, 800, sdr::gui::WaterFallView::RIGHT_LEFT),
+                    label);
+    }
+    splitter->addWidget(_tabs);
+  }
 
   QWidget *sidepanel = new QWidget();
   splitter->addWidget(sidepanel);
@@ -27,13 +47,7 @@ MainWindow::MainWindow(Receiver *rx, QWidget *parent) :
   _queueStartStop = new QPushButton();
   spLayout->addWidget(_queueStartStop);
   _queueStartStop->setCheckable(true);
-  if (sdr::Queue::get().isRunning()) {
-    _queueStartStop->setText("Stop");
-    _queueStartStop->setChecked(true);
-  } else {
-    _queueStartStop->setText("Start");
-    _queueStartStop->setChecked(false);
-  }
+  onQueueStateChanged();
 
   QGroupBox *sourceBox = new QGroupBox("Source");
   spLayout->addWidget(sourceBox, 0);
@@ -43,6 +57,9 @@ MainWindow::MainWindow(Receiver *rx, QWidget *parent) :
   _sourceSelect = new QComboBox();
   _sourceSelect->addItem("Audio", Receiver::AUDIO_SOURCE);
   _sourceSelect->addItem("IQ Audio", Receiver::IQ_AUDIO_SOURCE);
+  _sourceSelect->addItem("Audio channel", Receiver::CHANNEL_AUDIO_SOURCE);
+  _sourceSelect->addItem("Synthetic", Receiver::SYNTHETIC_SOURCE);
+  _sourceSelect->setCurrentIndex(_sourceSelect->findData(_receiver->sourceType()));
   _sourceLayout->addWidget(_sourceSelect);
   _sourceLayout->addWidget(_receiver->sourceView());
 
@@ -83,7 +100,17 @@ MainWindow::MainWindow(Receiver *rx, QWidget *parent) :
 
   QCheckBox *monitor = new QCheckBox();
   monitor->setChecked(_receiver->monitor());
-  cfgLayout->addRow("Audio monitor", monitor);
+  QCheckBox *monitorBand = new QCheckBox("Band only");
+  monitorBand->setChecked(_receiver->monitorBandLimited());
+  QVBoxLayout *monitorLayout = new QVBoxLayout();
+  monitorLayout->addWidget(monitor);
+  monitorLayout->addWidget(monitorBand);
+  cfgLayout->addRow("Audio monitor", monitorLayout);
+
+  _load = new QLabel();
+  cfgLayout->addRow("DSP load", _load);
+  _loadTimer.setInterval(1000);
+  _loadTimer.setSingleShot(false);
 
   setCentralWidget(splitter);
 
@@ -95,13 +122,26 @@ MainWindow::MainWindow(Receiver *rx, QWidget *parent) :
   QObject::connect(agc, SIGNAL(toggled(bool)), this, SLOT(onAGCToggled(bool)));
   QObject::connect(_gain, SIGNAL(returnPressed()), this, SLOT(onGainChanged()));
   QObject::connect(monitor, SIGNAL(toggled(bool)), this, SLOT(onMonitorToggled(bool)));
+  QObject::connect(monitorBand, SIGNAL(toggled(bool)), this, SLOT(onMonitorBandLimitedToggled(bool)));
   QObject::connect(&_gainTimer, SIGNAL(timeout()), this, SLOT(onGainUpdate()));
+  QObject::connect(&_loadTimer, SIGNAL(timeout()), this, SLOT(onLoadUpdate()));
 
   if (_receiver->agcEnabled()) { _gainTimer.start(); }
+  _loadTimer.start();
+
+  // Keep the buttons of all windows in sync with the (shared) queue
+  sdr::Queue::get().addStart(this, &MainWindow::onQueueStartedStopped);
+  sdr::Queue::get().addStop(this, &MainWindow::onQueueStartedStopped);
+}
+
+MainWindow::~MainWindow() {
+  sdr::Queue::get().remStart(this);
+  sdr::Queue::get().remStop(this);
 }
 
 void
 MainWindow::onQueueStartStop(bool start) {
+  // The buttons of all windows get updated by the start/stop callbacks of the queue
   if (start && !sdr::Queue::get().isRunning()) {
     sdr::Queue::get().start();
     _queueStartStop->setText("Stop");
@@ -112,14 +152,27 @@ MainWindow::onQueueStartStop(bool start) {
   }
 }
 
+void
+MainWindow::onQueueStateChanged() {
+  bool isRunning = sdr::Queue::get().isRunning();
+  _queueStartStop->blockSignals(true);
+  _queueStartStop->setChecked(isRunning);
+  _queueStartStop->setText(isRunning ? "Stop" : "Start");
+  _queueStartStop->blockSignals(false);
+}
+
+void
+MainWindow::onQueueStartedStopped() {
+  // Update the button within the GUI thread
+  QMetaObject::invokeMethod(this, "onQueueStateChanged", Qt::QueuedConnection);
+}
+
 void
 MainWindow::onSourceSelected(int idx) {
   Receiver::SourceType src = Receiver::SourceType(_sourceSelect->itemData(idx).toUInt());
-  bool isRunning = sdr::Queue::get().isRunning();
-  if (isRunning) { sdr::Queue::get().stop(); sdr::Queue::get().wait(); }
+  // Switches the source of this receiver only
   _receiver->setSourceType(src);
   _sourceLayout->addWidget(_receiver->sourceView());
-  if (isRunning) { sdr::Queue::get().start(); }
 }
 
 void
@@ -130,6 +183,7 @@ MainWindow::onBFOFreqChanged() {
 void
 MainWindow::onDotLengthChanged() {
   _receiver->setDotLength(_dotLen->text().toDouble());
+  if (_tabs) { _tabs->setTabText(0, QString("QRSS%1").arg(_receiver->dotLength())); }
 }
 
 void
@@ -159,3 +213,17 @@ void
 MainWindow::onMonitorToggled(bool enabled) {
   _receiver->setMonitor(enabled);
 }
+
+void
+MainWindow::onMonitorBandLimitedToggled(bool enabled) {
+  _receiver->setMonitorBandLimited(enabled);
+}
+
+void
+MainWindow::onLoadUpdate() {
+  const sdr::DeadlineMonitor &deadlines = _receiver->deadlines();
+  _load->setText(QString("%1% (max. %2%), %3 missed")
+                 .arg(100*deadlines.meanLoad(), 0, 'f', 1)
+                 .arg(100*deadlines.maxLoad(), 0, 'f', 1)
+                 .arg(deadlines.misses()));
+}
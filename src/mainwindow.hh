@@ -7,6 +7,8 @@
 #include <QComboBox>
 #include <QLineEdit>
 #include <QTimer>
+#include <QLabel>
+#include <QTabWidget>
 
 #include "receiver.hh"
 
@@ -16,9 +18,11 @@ class MainWindow : public QMainWindow
 
 public:
   explicit MainWindow(Receiver *rx, QWidget *parent = 0);
+  virtual ~MainWindow();
 
 protected slots:
   void onQueueStartStop(bool start);
+  void onQueueStateChanged();
   void onSourceSelected(int idx);
   void onBFOFreqChanged();
   void onDotLengthChanged();
@@ -27,9 +31,17 @@ protected slots:
   void onGainChanged();
   void onGainUpdate();
   void onMonitorToggled(bool enabled);
+  void onMonitorBandLimitedToggled(bool enabled);
+  void onLoadUpdate();
+
+protected:
+  /** Called by the queue thread on start and stop of the queue, the queue is shared by the
+   * windows of all channels. */
+  void onQueueStartedStopped();
 
 protected:
   Receiver *_receiver;
+  QTabWidget *_tabs;
   QPushButton *_queueStartStop;
   QVBoxLayout *_sourceLayout;
   QComboBox *_sourceSelect;
@@ -38,6 +50,8 @@ protected:
   QLineEdit *_width;
   QLineEdit *_gain;
   QTimer    _gainTimer;
+  QLabel    *_load;
+  QTimer    _loadTimer;
 };
 
 #endif // MAINWINDOW_HH
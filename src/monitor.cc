@@ -0,0 +1,261 @@
+#include "monitor.hh"
+#include <logger.hh>
+#include <cmath>
+#include <time.h>
+
+using namespace sdr;
+
+/** Number of frames written to the output stream at once. */
+#define MONITOR_FRAMES 256
+/** Capacity of the ring buffer in samples, the actual fill is limited by the sample rate. */
+#define MONITOR_RING (1<<17)
+
+
+AudioMonitor::AudioMonitor(double Fbfo, double width, bool bandLimited, double Fmon)
+  : SinkBase(), _Fbfo(Fbfo), _width(width), _bandLimited(bandLimited), _reconfigure(false),
+    _enabled(true), _filterBand(false), _Fmon(Fmon),
+    _complexInput(false), _sampleRate(0), _outRate(0), _subsample(1), _mixInc(1), _mixPhase(1), _toneInc(1),
+    _tonePhase(1), _taps(), _hist(), _histPos(0), _sampleCount(0), _alpha(1), _lowpass(0), _out(),
+    _ring(MONITOR_RING), _ringLimit(0), _dropped(0), _streamRate(0), _stream(0), _openRate(0),
+    _quit(false)
+{
+  pthread_mutex_init(&_paramLock, 0);
+  pthread_create(&_thread, 0, &AudioMonitor::_player_main, this);
+}
+
+AudioMonitor::~AudioMonitor() {
+  _quit = true;
+  pthread_join(_thread, 0);
+  pthread_mutex_destroy(&_paramLock);
+}
+
+void
+AudioMonitor::config(const Config &src_cfg) {
+  // Requires type, sample-rate and buffer size
+  if (!src_cfg.hasType() || ! src_cfg.hasSampleRate() || !src_cfg.hasBufferSize()) { return; }
+
+  // check buffer type
+  if ((Config::typeId<Sample>() != src_cfg.type()) &&
+      (Config::typeId< std::complex<Sample> >() != src_cfg.type())) {
+    ConfigError err;
+    err << "Can not configure AudioMonitor node: Invalid buffer type " << src_cfg.type()
+        << ", expected " << Config::typeId<Sample>() << " or "
+        << Config::typeId< std::complex<Sample> >();
+    throw err;
+  }
+
+  _complexInput = (Config::typeId< std::complex<Sample> >() == src_cfg.type());
+  _sampleRate = src_cfg.sampleRate();
+  _out.resize(src_cfg.bufferSize());
+  // Buffer up to 0.5s of audio
+  _ringLimit = std::min(size_t(_sampleRate/2), _ring.capacity());
+  _reconfigure = false;
+  configFilter();
+}
+
+void
+AudioMonitor::configFilter() {
+  if (0 == _sampleRate) { return; }
+
+  pthread_mutex_lock(&_paramLock);
+  double Fbfo = _Fbfo, width = _width;
+  _filterBand = _bandLimited;
+  pthread_mutex_unlock(&_paramLock);
+
+  _outRate = _sampleRate; _subsample = 1;
+  if (_filterBand && (_Fmon < _sampleRate)) {
+    _subsample = _sampleRate/_Fmon;
+    _outRate = _sampleRate/_subsample;
+  }
+  _sampleCount = 0; _lowpass = 0;
+
+  // Anti-aliasing low-pass (Hamming windowed sinc) at the input rate. Everything within
+  // width/2 of a multiple of the output rate folds into the band, hence the transition band
+  // spans from width/2 to outRate-width/2.
+  double transition = std::max(_outRate-width, 0.1*_outRate);
+  size_t ntaps = (2*size_t(std::ceil(1.65*_sampleRate/transition)))+1;
+  double fc = 0.5*_outRate/_sampleRate, sum = 0;
+  _taps.resize(ntaps);
+  for (size_t k=0; k<ntaps; k++) {
+    double n = double(k) - double(ntaps-1)/2;
+    double sinc = (0 == n) ? 2*fc : std::sin(2*M_PI*fc*n)/(M_PI*n);
+    _taps[k] = sinc*(0.54 - 0.46*std::cos(2*M_PI*k/(ntaps-1)));
+    sum += _taps[k];
+  }
+  for (size_t k=0; k<ntaps; k++) { _taps[k] /= sum; }
+  _hist.assign(2*ntaps, 0); _histPos = 0;
+
+  // Keep the pitch of the BFO if it fits into the output band
+  double Ftone = Fbfo;
+  if ((Fbfo + width/2) >= _outRate/2) { Ftone = _outRate/4; }
+  _mixInc   = std::exp(std::complex<float>(0, -2*M_PI*Fbfo/_sampleRate));
+  _toneInc  = std::exp(std::complex<float>(0, 2*M_PI*Ftone/_outRate));
+  _alpha    = 1 - std::exp(-2*M_PI*(width/2)/_outRate);
+
+  // The playback thread reopens the stream if the rate changed
+  _streamRate = _outRate;
+}
+
+void
+AudioMonitor::handleBuffer(const RawBuffer &buffer, bool allow_overwrite) {
+  // Apply parameter changes
+  if (_reconfigure.exchange(false)) { configFilter(); }
+  if (! _enabled) { return; }
+
+  if (_complexInput) {
+    Buffer< std::complex<Sample> > input(buffer);
+    processBand(reinterpret_cast<const std::complex<Sample> *>(input.data()), input.size());
+    return;
+  }
+
+  Buffer<Sample> input(buffer);
+  // Full band monitor, just pass samples to the player
+  if ((! _filterBand) || (1 == _subsample)) {
+    play(reinterpret_cast<const Sample *>(input.data()), input.size());
+    return;
+  }
+  processBand(reinterpret_cast<const Sample *>(input.data()), input.size());
+}
+
+template <class Scalar>
+void
+AudioMonitor::processBand(const Scalar *samples, size_t N) {
+  // Shift Fbfo to 0, low-pass, sub-sample, low-pass to the band and shift up to the tone.
+  const size_t ntaps = _taps.size();
+  size_t nout = 0;
+  for (size_t i=0; i<N; i++) {
+    std::complex<float> x = mixSample(_mixPhase, samples[i]); _mixPhase *= _mixInc;
+    _hist[_histPos] = _hist[_histPos+ntaps] = x;
+    _histPos = (_histPos+1) % ntaps;
+    if (_subsample <= ++_sampleCount) {
+      // The filter is symmetric, the window starts at the oldest sample
+      const std::complex<float> *window = &_hist[_histPos];
+      std::complex<float> y = 0;
+      for (size_t k=0; k<ntaps; k++) { y += _taps[k]*window[k]; }
+      _lowpass += _alpha*(y - _lowpass);
+      float value = (_complexInput ? 1 : 2)*std::real(_lowpass*_tonePhase); _tonePhase *= _toneInc;
+      _out[nout++] = SampleTraits<Sample>::fromFloat(value);
+      _sampleCount = 0;
+    }
+  }
+  // Avoid drift of the mixer amplitudes
+  _mixPhase /= std::abs(_mixPhase);
+  _tonePhase /= std::abs(_tonePhase);
+
+  play(&_out[0], nout);
+}
+
+void
+AudioMonitor::play(const Sample *samples, size_t N) {
+  size_t limit = _ringLimit, fill = std::min(limit, _ring.available());
+  size_t n = _ring.put(samples, std::min(N, limit-fill));
+  _dropped += N-n;
+}
+
+bool
+AudioMonitor::enabled() const {
+  return _enabled;
+}
+
+void
+AudioMonitor::setEnabled(bool enabled) {
+  _enabled = enabled;
+}
+
+bool
+AudioMonitor::bandLimited() const {
+  pthread_mutex_lock(&_paramLock);
+  bool enabled = _bandLimited;
+  pthread_mutex_unlock(&_paramLock);
+  return enabled;
+}
+
+void
+AudioMonitor::setBandLimited(bool enabled) {
+  pthread_mutex_lock(&_paramLock);
+  _bandLimited = enabled;
+  pthread_mutex_unlock(&_paramLock);
+  _reconfigure = true;
+}
+
+void
+AudioMonitor::setFbfo(double F) {
+  pthread_mutex_lock(&_paramLock);
+  _Fbfo = F;
+  pthread_mutex_unlock(&_paramLock);
+  _reconfigure = true;
+}
+
+void
+AudioMonitor::setWidth(double width) {
+  pthread_mutex_lock(&_paramLock);
+  _width = width;
+  pthread_mutex_unlock(&_paramLock);
+  _reconfigure = true;
+}
+
+size_t
+AudioMonitor::dropped() const {
+  return _dropped;
+}
+
+void
+AudioMonitor::openStream(double rate) {
+  _openRate = rate;
+
+  PaStreamParameters params;
+  params.device = Pa_GetDefaultOutputDevice();
+  params.channelCount = 1;
+  params.sampleFormat = SampleTraits<Sample>::paFormat();
+  params.suggestedLatency = 0;
+  params.hostApiSpecificStreamInfo = 0;
+  if (const PaDeviceInfo *info = Pa_GetDeviceInfo(params.device)) {
+    params.suggestedLatency = info->defaultLowOutputLatency;
+  }
+
+  PaError err = Pa_OpenStream(&_stream, 0, &params, rate, MONITOR_FRAMES, paNoFlag, 0, 0);
+  if (paNoError != err) {
+    LogMessage msg(LOG_ERROR);
+    msg << "Can not open audio monitor output: " << Pa_GetErrorText(err);
+    Logger::get().log(msg);
+    _stream = 0;
+    return;
+  }
+  Pa_StartStream(_stream);
+}
+
+void
+AudioMonitor::closeStream() {
+  _openRate = 0;
+  if (0 == _stream) { return; }
+  Pa_StopStream(_stream);
+  Pa_CloseStream(_stream);
+  _stream = 0;
+}
+
+void *
+AudioMonitor::_player_main(void *ctx) {
+  AudioMonitor *self = reinterpret_cast<AudioMonitor *>(ctx);
+  Sample frames[MONITOR_FRAMES];
+  while (! self->_quit) {
+    // (Re-) Open the stream if the playback got enabled/disabled or the rate changed, samples
+    // at the previous rate are discarded.
+    double rate = self->_enabled ? self->_streamRate.load() : 0;
+    if (rate != self->_openRate) {
+      self->closeStream();
+      while (self->_ring.take(frames, MONITOR_FRAMES)) { }
+      if (0 < rate) { self->openStream(rate); }
+    }
+    if (0 == self->_stream) {
+      struct timespec ts; ts.tv_sec = 0; ts.tv_nsec = 10000000L;
+      nanosleep(&ts, 0);
+      continue;
+    }
+    // Fill up with silence on underrun, the blocking write paces this loop.
+    size_t n = self->_ring.take(frames, MONITOR_FRAMES);
+    for (size_t i=n; i<MONITOR_FRAMES; i++) { frames[i] = 0; }
+    Pa_WriteStream(self->_stream, frames, MONITOR_FRAMES);
+  }
+  self->closeStream();
+  return 0;
+}
@@ -0,0 +1,143 @@
+#ifndef __SDR_QRSS_MONITOR_HH__
+#define __SDR_QRSS_MONITOR_HH__
+
+#include <node.hh>
+#include <portaudio.h>
+#include <pthread.h>
+#include <atomic>
+#include "spscring.hh"
+#include "sample.hh"
+
+
+namespace sdr {
+
+/** Audio monitor sink, decoupled from the processing chain.
+ *
+ * The received samples are put into a lock-free ring buffer which is played back by a dedicated
+ * thread. If the playback does not keep up, the samples are dropped, hence the monitor never
+ * blocks the processing thread.
+ *
+ * Optionally, the monitor plays only a narrow band of @c width Hz around the BFO frequency at
+ * a reduced sample rate. In this case, the band is low-pass filtered, sub-sampled and shifted to
+ * the monitor tone frequency. Complex (IQ) input is always filtered around the BFO frequency,
+ * this demodulates the upper side band.
+ *
+ * The parameters and the playback state may be changed from any thread, the processing thread
+ * applies them at the start of the next buffer. The output stream is owned by the playback
+ * thread, which (re-) opens it whenever the playback is enabled or the output rate changes. */
+class AudioMonitor: public SinkBase
+{
+public:
+  /** Constructor.
+   * @param Fbfo Specifies the BFO frequency in Hz.
+   * @param width Specifies the width of the band-limited monitor in Hz.
+   * @param bandLimited If @c true, only the band around @c Fbfo is played back.
+   * @param Fmon Specifies the sample rate of the band-limited monitor in Hz. */
+  AudioMonitor(double Fbfo=800, double width=300, bool bandLimited=false, double Fmon=4000);
+  /** Destructor. */
+  virtual ~AudioMonitor();
+
+  /** Configures the monitor. */
+  virtual void config(const Config &src_cfg);
+  /** Puts the received samples into the ring buffer. */
+  virtual void handleBuffer(const RawBuffer &buffer, bool allow_overwrite);
+
+  /** Returns @c true if the playback is enabled. */
+  bool enabled() const;
+  /** Enables/Disables the playback. */
+  void setEnabled(bool enabled);
+  /** Returns @c true if the band-limited monitor is enabled. */
+  bool bandLimited() const;
+  /** Enables/Disables the band-limited monitor. */
+  void setBandLimited(bool enabled);
+  /** Sets the BFO frequency (Hz). */
+  void setFbfo(double F);
+  /** Sets the width of the band-limited monitor (Hz). */
+  void setWidth(double width);
+  /** Returns the number of samples dropped due to playback overruns. */
+  size_t dropped() const;
+
+protected:
+  /** (Re-) Configures the band-limited monitor from the current parameters. Must be called
+   * from the processing thread. */
+  void configFilter();
+  /** Filters the band around the BFO frequency and puts it into the ring buffer. */
+  template <class Scalar>
+  void processBand(const Scalar *samples, size_t N);
+  /** Puts the samples into the ring buffer, drops them if the playback does not keep up. */
+  void play(const Sample *samples, size_t N);
+  /** Opens and starts the output stream at the given rate (playback thread only). */
+  void openStream(double rate);
+  /** Stops and closes the output stream (playback thread only). */
+  void closeStream();
+  /** The main loop of the playback thread. */
+  static void *_player_main(void *ctx);
+
+protected:
+  /** The BFO frequency, protected by @c _paramLock. */
+  double _Fbfo;
+  /** The width of the band-limited monitor, protected by @c _paramLock. */
+  double _width;
+  /** If @c true, the band-limited monitor is enabled, protected by @c _paramLock. */
+  bool _bandLimited;
+  /** Protects the parameters above. */
+  mutable pthread_mutex_t _paramLock;
+  /** If @c true, the parameters changed and the filter needs to be reconfigured. */
+  std::atomic<bool> _reconfigure;
+  /** If @c true, the playback is enabled. */
+  std::atomic<bool> _enabled;
+  /** If @c true, the band-limited monitor is configured (processing thread only). */
+  bool _filterBand;
+  /** Sample rate of the band-limited monitor. */
+  double _Fmon;
+  /** If @c true, the input is complex. */
+  bool _complexInput;
+  /** The input sample rate. */
+  double _sampleRate;
+  /** The output sample rate. */
+  double _outRate;
+  /** Sub-sample factor of the band-limited monitor. */
+  size_t _subsample;
+  /** Phase increment of the input mixer. */
+  std::complex<float> _mixInc;
+  /** Phase of the input mixer. */
+  std::complex<float> _mixPhase;
+  /** Phase increment of the output mixer. */
+  std::complex<float> _toneInc;
+  /** Phase of the output mixer. */
+  std::complex<float> _tonePhase;
+  /** Coefficients of the anti-aliasing low-pass in front of the sub-sampling. */
+  std::vector<float> _taps;
+  /** The recent mixed input samples, stored twice for a contiguous filter window. */
+  std::vector< std::complex<float> > _hist;
+  /** Write position in @c _hist. */
+  size_t _histPos;
+  /** Number of input samples since the last output sample. */
+  size_t _sampleCount;
+  /** Coefficient of the low-pass filter. */
+  float _alpha;
+  /** State of the low-pass filter. */
+  std::complex<float> _lowpass;
+  /** Output buffer of the band-limited monitor. */
+  std::vector<Sample> _out;
+  /** The ring buffer between processing and playback thread. */
+  SPSCRing<Sample> _ring;
+  /** Max. number of samples buffered by the ring (0.5s of audio). */
+  std::atomic<size_t> _ringLimit;
+  /** Number of dropped samples. */
+  size_t _dropped;
+  /** The output rate requested by the processing thread. */
+  std::atomic<double> _streamRate;
+  /** The output stream (playback thread only). */
+  PaStream *_stream;
+  /** The rate of the output stream (playback thread only). */
+  double _openRate;
+  /** If @c true, the playback thread terminates. */
+  volatile bool _quit;
+  /** The playback thread. */
+  pthread_t _thread;
+};
+
+}
+
+#endif // __SDR_QRSS_MONITOR_HH__
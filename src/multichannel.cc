@@ -0,0 +1,316 @@
+#include "multichannel.hh"
+#include <queue.hh>
+#include <logger.hh>
+#include <algorithm>
+#include <time.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#ifdef __SSE__
+#include <xmmintrin.h>
+#endif
+
+using namespace sdr;
+
+/** Number of consecutive read errors, after which the reader thread gives up. */
+#define MULTICHANNEL_MAX_ERRORS 50
+
+
+void
+sdr::deinterleave(const int16_t *in, int16_t * const *out, size_t nframes, size_t nch) {
+  size_t i = 0;
+#ifdef __SSE2__
+  // Fast path for stereo: A frame is a 32bit word holding the left sample in the lower and the
+  // right sample in the upper half, so 8 frames are split with shifts and a single pack.
+  if (2 == nch) {
+    int16_t *left = out[0], *right = out[1];
+    for (; (i+8)<=nframes; i+=8) {
+      __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + 2*i));
+      __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in + 2*i + 8));
+      __m128i la = _mm_srai_epi32(_mm_slli_epi32(a, 16), 16);
+      __m128i lb = _mm_srai_epi32(_mm_slli_epi32(b, 16), 16);
+      __m128i ra = _mm_srai_epi32(a, 16);
+      __m128i rb = _mm_srai_epi32(b, 16);
+      _mm_storeu_si128(reinterpret_cast<__m128i *>(left + i), _mm_packs_epi32(la, lb));
+      _mm_storeu_si128(reinterpret_cast<__m128i *>(right + i), _mm_packs_epi32(ra, rb));
+    }
+  }
+#endif
+  // Generic (and remaining frames)
+  for (; i<nframes; i++) {
+    for (size_t c=0; c<nch; c++) {
+      out[c][i] = in[i*nch + c];
+    }
+  }
+}
+
+void
+sdr::deinterleave(const float *in, float * const *out, size_t nframes, size_t nch) {
+  size_t i = 0;
+#ifdef __SSE__
+  // Fast path for stereo: Split 4 frames into the even (left) and odd (right) samples.
+  if (2 == nch) {
+    float *left = out[0], *right = out[1];
+    for (; (i+4)<=nframes; i+=4) {
+      __m128 a = _mm_loadu_ps(in + 2*i);
+      __m128 b = _mm_loadu_ps(in + 2*i + 4);
+      _mm_storeu_ps(left + i, _mm_shuffle_ps(a, b, _MM_SHUFFLE(2,0,2,0)));
+      _mm_storeu_ps(right + i, _mm_shuffle_ps(a, b, _MM_SHUFFLE(3,1,3,1)));
+    }
+  }
+#endif
+  // Generic (and remaining frames)
+  for (; i<nframes; i++) {
+    for (size_t c=0; c<nch; c++) {
+      out[c][i] = in[i*nch + c];
+    }
+  }
+}
+
+
+/* ********************************************************************************************* *
+ * Implementation of MultiChannelAudioSource::Channel
+ * ********************************************************************************************* */
+MultiChannelAudioSource::Channel::Channel(size_t index, double sampleRate, size_t bufferSize)
+  : Source(), _index(index), _blocks(), _head(0), _count(0), _dropped(0), _running(false)
+{
+  for (size_t i=0; i<4; i++) {
+    _blocks.push_back(Buffer<Sample>(bufferSize));
+  }
+  pthread_mutex_init(&_lock, 0);
+  pthread_cond_init(&_cond, 0);
+  setConfig(Config(Config::typeId<Sample>(), sampleRate, bufferSize, _blocks.size()));
+}
+
+MultiChannelAudioSource::Channel::~Channel() {
+  stop();
+  pthread_cond_destroy(&_cond);
+  pthread_mutex_destroy(&_lock);
+}
+
+void
+MultiChannelAudioSource::Channel::start() {
+  if (_running) { return; }
+  // The reader thread may be running already
+  pthread_mutex_lock(&_lock);
+  _head = 0; _count = 0; _dropped = 0; _running = true;
+  pthread_mutex_unlock(&_lock);
+  pthread_create(&_thread, 0, &Channel::_worker_main, this);
+}
+
+void
+MultiChannelAudioSource::Channel::stop() {
+  if (! _running) { return; }
+  pthread_mutex_lock(&_lock);
+  _running = false;
+  pthread_cond_signal(&_cond);
+  pthread_mutex_unlock(&_lock);
+  pthread_join(_thread, 0);
+
+  if (_dropped) {
+    LogMessage msg(LOG_WARNING);
+    msg << "Channel " << _index << " dropped " << _dropped << " blocks.";
+    Logger::get().log(msg);
+  }
+}
+
+Sample *
+MultiChannelAudioSource::Channel::freeBlock() {
+  pthread_mutex_lock(&_lock);
+  // Stopped channels are skipped silently
+  if (! _running) {
+    pthread_mutex_unlock(&_lock);
+    return 0;
+  }
+  if (_blocks.size() == _count) {
+    _dropped++;
+    pthread_mutex_unlock(&_lock);
+    return 0;
+  }
+  Sample *block = reinterpret_cast<Sample *>(_blocks[_head].data());
+  pthread_mutex_unlock(&_lock);
+  return block;
+}
+
+void
+MultiChannelAudioSource::Channel::commitBlock() {
+  pthread_mutex_lock(&_lock);
+  _head = (_head+1) % _blocks.size(); _count++;
+  pthread_cond_signal(&_cond);
+  pthread_mutex_unlock(&_lock);
+}
+
+void *
+MultiChannelAudioSource::Channel::_worker_main(void *ctx) {
+  Channel *self = reinterpret_cast<Channel *>(ctx);
+  pthread_mutex_lock(&self->_lock);
+  while (self->_running) {
+    if (0 == self->_count) {
+      pthread_cond_wait(&self->_cond, &self->_lock);
+      continue;
+    }
+    // The oldest block, is not touched by the reader until _count gets decremented.
+    size_t idx = (self->_head + self->_blocks.size() - self->_count) % self->_blocks.size();
+    pthread_mutex_unlock(&self->_lock);
+    self->send(self->_blocks[idx]);
+    pthread_mutex_lock(&self->_lock);
+    self->_count--;
+  }
+  pthread_mutex_unlock(&self->_lock);
+  return 0;
+}
+
+
+/* ********************************************************************************************* *
+ * Implementation of MultiChannelAudioSource
+ * ********************************************************************************************* */
+MultiChannelAudioSource *MultiChannelAudioSource::_instance = 0;
+size_t MultiChannelAudioSource::_refcount = 0;
+
+MultiChannelAudioSource *
+MultiChannelAudioSource::acquire(double sampleRate, size_t bufferSize, size_t channels, int device) {
+  if (0 == _instance) {
+    _instance = new MultiChannelAudioSource(sampleRate, bufferSize, channels, device);
+  }
+  _refcount++;
+  return _instance;
+}
+
+void
+MultiChannelAudioSource::release() {
+  if (0 == _refcount) { return; }
+  if (0 == --_refcount) {
+    delete _instance;
+    _instance = 0;
+  }
+}
+
+MultiChannelAudioSource::MultiChannelAudioSource(double sampleRate, size_t bufferSize,
+                                                 size_t channels, int device)
+  : _sampleRate(sampleRate), _bufferSize(bufferSize), _device(device), _stream(0),
+    _frames(bufferSize*channels), _scratch(bufferSize), _channels(), _running(false)
+{
+  for (size_t i=0; i<channels; i++) {
+    _channels.push_back(new Channel(i, sampleRate, bufferSize));
+  }
+
+  if (0 > _device) { _device = Pa_GetDefaultInputDevice(); }
+  PaStreamParameters params;
+  params.device = _device;
+  params.channelCount = channels;
+  params.sampleFormat = SampleTraits<Sample>::paFormat();
+  params.suggestedLatency = 0;
+  params.hostApiSpecificStreamInfo = 0;
+  if (const PaDeviceInfo *info = Pa_GetDeviceInfo(_device)) {
+    params.suggestedLatency = info->defaultLowInputLatency;
+  }
+
+  PaError err = Pa_OpenStream(&_stream, &params, 0, _sampleRate, _bufferSize, paNoFlag, 0, 0);
+  if (paNoError != err) {
+    LogMessage msg(LOG_ERROR);
+    msg << "Can not open " << channels << " channel input of device " << _device << ": "
+        << Pa_GetErrorText(err);
+    Logger::get().log(msg);
+    _stream = 0;
+  }
+
+  Queue::get().addStart(this, &MultiChannelAudioSource::start);
+  Queue::get().addStop(this, &MultiChannelAudioSource::stop);
+}
+
+MultiChannelAudioSource::~MultiChannelAudioSource() {
+  Queue::get().remStart(this);
+  Queue::get().remStop(this);
+  stop();
+  if (0 != _stream) { Pa_CloseStream(_stream); }
+  for (size_t i=0; i<_channels.size(); i++) {
+    delete _channels[i];
+  }
+}
+
+size_t
+MultiChannelAudioSource::numChannels() const {
+  return _channels.size();
+}
+
+Source *
+MultiChannelAudioSource::channel(size_t idx) {
+  if (idx >= _channels.size()) { return 0; }
+  return _channels[idx];
+}
+
+void
+MultiChannelAudioSource::start() {
+  if (_running || (0 == _stream)) { return; }
+  for (size_t i=0; i<_channels.size(); i++) {
+    _channels[i]->start();
+  }
+  Pa_StartStream(_stream);
+  _running = true;
+  pthread_create(&_thread, 0, &MultiChannelAudioSource::_reader_main, this);
+}
+
+void
+MultiChannelAudioSource::stop() {
+  if (! _running) { return; }
+  _running = false;
+  pthread_join(_thread, 0);
+  Pa_StopStream(_stream);
+  for (size_t i=0; i<_channels.size(); i++) {
+    _channels[i]->stop();
+  }
+}
+
+void
+MultiChannelAudioSource::startChannel(size_t idx) {
+  if (idx >= _channels.size()) { return; }
+  // Starting the device starts all channels
+  if (! _running) { start(); }
+  else { _channels[idx]->start(); }
+}
+
+void
+MultiChannelAudioSource::stopChannel(size_t idx) {
+  if (idx >= _channels.size()) { return; }
+  _channels[idx]->stop();
+}
+
+void *
+MultiChannelAudioSource::_reader_main(void *ctx) {
+  MultiChannelAudioSource *self = reinterpret_cast<MultiChannelAudioSource *>(ctx);
+  size_t nch = self->_channels.size();
+  std::vector<Sample *> blocks(nch);
+
+  size_t errors = 0;
+  while (self->_running) {
+    PaError err = Pa_ReadStream(self->_stream, &(self->_frames[0]), self->_bufferSize);
+    if ((paNoError != err) && (paInputOverflowed != err)) {
+      // Log the first error only and back off, give up if the device does not recover
+      if (0 == errors) {
+        LogMessage msg(LOG_WARNING);
+        msg << "Multi-channel audio input: " << Pa_GetErrorText(err);
+        Logger::get().log(msg);
+      }
+      if (MULTICHANNEL_MAX_ERRORS == ++errors) {
+        LogMessage msg(LOG_ERROR);
+        msg << "Multi-channel audio input: Giving up after " << errors << " errors.";
+        Logger::get().log(msg);
+        break;
+      }
+      struct timespec ts; ts.tv_sec = 0; ts.tv_nsec = std::min(errors, size_t(100))*10000000L;
+      nanosleep(&ts, 0);
+      continue;
+    }
+    errors = 0;
+    // Channels that are not keeping up get their block dropped
+    for (size_t c=0; c<nch; c++) {
+      blocks[c] = self->_channels[c]->freeBlock();
+      if (0 == blocks[c]) { blocks[c] = &(self->_scratch[0]); }
+    }
+    deinterleave(&(self->_frames[0]), &(blocks[0]), self->_bufferSize, nch);
+    for (size_t c=0; c<nch; c++) {
+      if (&(self->_scratch[0]) != blocks[c]) { self->_channels[c]->commitBlock(); }
+    }
+  }
+  return 0;
+}
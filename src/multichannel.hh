@@ -0,0 +1,143 @@
+#ifndef __SDR_QRSS_MULTICHANNEL_HH__
+#define __SDR_QRSS_MULTICHANNEL_HH__
+
+#include <node.hh>
+#include <portaudio.h>
+#include <pthread.h>
+#include <vector>
+#include "sample.hh"
+
+
+namespace sdr {
+
+/** Splits the interleaved frames in @c in into the separate channel buffers @c out.
+ * @param in The interleaved input of @c nframes frames with @c nch samples each.
+ * @param out Array of @c nch channel buffers, each holding at least @c nframes samples.
+ * @param nframes Number of frames to deinterleave.
+ * @param nch Number of channels per frame. */
+void deinterleave(const int16_t *in, int16_t * const *out, size_t nframes, size_t nch);
+/** Splits the interleaved frames in @c in into the separate channel buffers @c out. */
+void deinterleave(const float *in, float * const *out, size_t nframes, size_t nch);
+
+
+/** Opens a multi-channel sound card once and provides each channel as an independent source.
+ *
+ * The device is read by a dedicated thread, each block is deinterleaved and handed over to one
+ * worker thread per channel. Each worker then passes the channel data to the sinks connected to
+ * the channel source. Hence the processing chains attached to the channels run in parallel. Sinks
+ * should therefore be connected directly to the channel sources.
+ *
+ * As the device can only be opened once, there is only one instance, obtained by @c acquire and
+ * returned by @c release. */
+class MultiChannelAudioSource
+{
+protected:
+  /** A single channel of the device. */
+  class Channel: public Source
+  {
+  public:
+    /** Constructor. */
+    Channel(size_t index, double sampleRate, size_t bufferSize);
+    /** Destructor. */
+    virtual ~Channel();
+
+    /** Starts the worker thread of this channel. */
+    void start();
+    /** Stops the worker thread of this channel. */
+    void stop();
+
+    /** Returns the next free block or @c 0 if the channel is stopped or the worker is not keeping
+     * up. */
+    Sample *freeBlock();
+    /** Marks the block previously obtained by @c freeBlock as ready for processing. */
+    void commitBlock();
+
+  protected:
+    /** The main loop of the worker thread. */
+    static void *_worker_main(void *ctx);
+
+  protected:
+    /** The channel index. */
+    size_t _index;
+    /** The block buffers. */
+    std::vector< Buffer<Sample> > _blocks;
+    /** Index of the next block to be filled. */
+    size_t _head;
+    /** Number of blocks ready to be processed. */
+    size_t _count;
+    /** Number of blocks dropped due to an overrun of this channel. */
+    size_t _dropped;
+    /** If @c true, the worker thread is running. */
+    volatile bool _running;
+    /** Protects the block ring. */
+    pthread_mutex_t _lock;
+    /** Signals the worker about new blocks. */
+    pthread_cond_t _cond;
+    /** The worker thread. */
+    pthread_t _thread;
+  };
+
+public:
+  /** Returns the device instance, opens the device if needed. If the device is already open,
+   * the arguments are ignored. */
+  static MultiChannelAudioSource *acquire(double sampleRate, size_t bufferSize, size_t channels,
+                                          int device=-1);
+  /** Releases a reference obtained by @c acquire. Closes the device once all references have
+   * been released. */
+  static void release();
+
+  /** Returns the number of channels. */
+  size_t numChannels() const;
+  /** Returns the source of the specified channel or @c 0 if there is no such channel. */
+  Source *channel(size_t idx);
+
+  /** Starts reading from the device. */
+  void start();
+  /** Stops reading from the device. */
+  void stop();
+
+  /** Starts a single channel while the other channels keep running, starts the device if it is
+   * not running yet. */
+  void startChannel(size_t idx);
+  /** Stops a single channel while the other channels keep running. Once this method returns,
+   * nothing is sent to the sinks of the channel anymore. */
+  void stopChannel(size_t idx);
+
+protected:
+  /** Hidden constructor, use @c acquire. */
+  MultiChannelAudioSource(double sampleRate, size_t bufferSize, size_t channels, int device);
+  /** Hidden destructor, use @c release. */
+  virtual ~MultiChannelAudioSource();
+
+  /** The main loop of the reader thread. */
+  static void *_reader_main(void *ctx);
+
+protected:
+  /** The sample rate. */
+  double _sampleRate;
+  /** The number of frames per block. */
+  size_t _bufferSize;
+  /** The device index. */
+  int _device;
+  /** The PortAudio stream. */
+  PaStream *_stream;
+  /** The interleaved input buffer. */
+  std::vector<Sample> _frames;
+  /** Receives the samples of channels that are not keeping up. */
+  std::vector<Sample> _scratch;
+  /** The channels. */
+  std::vector<Channel *> _channels;
+  /** If @c true, the reader thread is running. */
+  volatile bool _running;
+  /** The reader thread. */
+  pthread_t _thread;
+
+  /** The singleton instance. */
+  static MultiChannelAudioSource *_instance;
+  /** Reference count of the singleton instance. */
+  static size_t _refcount;
+};
+
+}
+
+#endif // __SDR_QRSS_MULTICHANNEL_HH__
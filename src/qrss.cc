@@ -1,65 +1,177 @@
 #include "qrss.hh"
+#include <cmath>
+#include <algorithm>
 
 using namespace sdr;
 
-QRSS::QRSS(double Fbfo, double dotlen, double width):
-  gui::SpectrumProvider(), sdr::Sink<int16_t>(), _Fbfo(Fbfo), _dotlen(dotlen), _width(width),
-  _samplerate(0), _fshift(0,0), _subsample(0),
-  _N_fft(0), _fft_count(0), _fft_in(0), _fft_out(0), _fft(0), _currPSD()
+
+/* ********************************************************************************************* *
+ * Implementation of QRSSResolution
+ * ********************************************************************************************* */
+QRSSResolution::QRSSResolution(double dotlen, double hop)
+  : gui::SpectrumProvider(), _dotlen(dotlen), _hop(hop), _samplerate(0), _N_fft(0), _N_hop(0),
+    _count(0), _buffer(), _fft_in(0), _fft_out(0), _fft(0), _currPSD()
 {
   // pass...
 }
 
-
-QRSS::~QRSS() {
+QRSSResolution::~QRSSResolution() {
   if (0 != _fft) { delete _fft; }
 }
 
 bool
-QRSS::isInputReal() const {
+QRSSResolution::isInputReal() const {
   return false;
 }
 
 double
-QRSS::sampleRate() const {
+QRSSResolution::sampleRate() const {
   return _samplerate;
 }
 
 size_t
-QRSS::fftSize() const {
+QRSSResolution::fftSize() const {
   return _N_fft;
 }
 
 const Buffer<double> &
-QRSS::spectrum() const {
+QRSSResolution::spectrum() const {
   return _currPSD;
 }
 
+double
+QRSSResolution::dotLength() const {
+  return _dotlen;
+}
+
+double
+QRSSResolution::hop() const {
+  return _hop;
+}
+
+void
+QRSSResolution::config(double Fs, size_t subsample) {
+  _samplerate = Fs;
+  _N_fft = std::max(size_t(1), size_t(_dotlen*Fs/(2*subsample)));
+  _N_hop = std::max(size_t(1), std::min(_N_fft, size_t(_hop*_N_fft)));
+  _count = 0;
+  _buffer.resize(_N_fft);
+  _fft_in = Buffer< std::complex<float> >(_N_fft);
+  _fft_out = Buffer< std::complex<float> >(_N_fft);
+  _currPSD = Buffer< double >(_N_fft);
+  if (0 != _fft) { delete _fft; }
+  _fft = new FFTPlan<float>(_fft_in, _fft_out, FFT::FORWARD);
+
+  LogMessage msg(LOG_DEBUG);
+  msg << "Configure QRSS resolution:" << std::endl
+      << " Refresh period: " << _N_hop*subsample/Fs << "s" << std::endl
+      << " FFT length: " << _N_fft << std::endl
+      << " Freq. res: " << Fs/(subsample*_N_fft) << "Hz";
+  Logger::get().log(msg);
+
+  emit spectrumConfigured();
+}
 
 void
-QRSS::config(const Config &src_cfg) {
-  // Requires type, sample-rate and buffer size
-  if (!src_cfg.hasType() || ! src_cfg.hasSampleRate() || !src_cfg.hasBufferSize()) { return; }
-
-  // check buffer type
-  if (Config::typeId<int16_t>() != src_cfg.type()) {
-    ConfigError err;
-    err << "Can not configure QRSS node: Invalid buffer type " << src_cfg.type()
-        << ", expected " << Config::typeId<int16_t>();
-    throw err;
+QRSSResolution::updateSpectrum() {
+  // Compute FFT
+  std::copy(_buffer.begin(), _buffer.end(), &_fft_in[0]);
+  (*_fft)();
+  // Compute PSD
+  for (size_t j=0; j<_N_fft; j++) {
+    _currPSD[j] = _fft_out[j].real()*_fft_out[j].real()
+        + _fft_out[j].imag()*_fft_out[j].imag();
+  }
+  // Keep the overlap for the next frame
+  std::copy(_buffer.begin()+_N_hop, _buffer.end(), _buffer.begin());
+  _count = _N_fft-_N_hop;
+
+  // Notify spectrum views about the new spectrum.
+  emit spectrumUpdated();
+}
+
+
+/* ********************************************************************************************* *
+ * Implementation of QRSSBase
+ * ********************************************************************************************* */
+
+QRSSBase::QRSSBase(double Fbfo, double dotlen, double width, float scale):
+  gui::SpectrumProvider(), _Fbfo(Fbfo), _newFbfo(Fbfo), _bfoChanged(false), _dotlen(dotlen),
+  _width(width), _samplerate(0), _complexInput(false), _scale(scale), _mixInc(1), _mixPhase(1), _subsample(0),
+  _avg_scale(0), _N_fft(0), _fft_count(0), _fft_in(0), _fft_out(0), _fft(0), _currPSD(),
+  _resolutions()
+{
+  // pass...
+}
+
+
+QRSSBase::~QRSSBase() {
+  if (0 != _fft) { delete _fft; }
+  for (size_t i=0; i<_resolutions.size(); i++) {
+    delete _resolutions[i];
   }
+}
+
+QRSSResolution *
+QRSSBase::addResolution(double dotlen, double hop) {
+  QRSSResolution *res = new QRSSResolution(dotlen, hop);
+  _resolutions.push_back(res);
+  configSpectrum();
+  return res;
+}
+
+size_t
+QRSSBase::numResolutions() const {
+  return _resolutions.size();
+}
+
+QRSSResolution *
+QRSSBase::resolution(size_t idx) {
+  return _resolutions[idx];
+}
+
+bool
+QRSSBase::isInputReal() const {
+  // The FFT input is the complex baseband, for real and complex input.
+  return false;
+}
+
+double
+QRSSBase::sampleRate() const {
+  return _samplerate;
+}
+
+size_t
+QRSSBase::fftSize() const {
+  return _N_fft;
+}
+
+const Buffer<double> &
+QRSSBase::spectrum() const {
+  return _currPSD;
+}
 
+
+void
+QRSSBase::configInput(double Fs, bool complexInput) {
   // Config frequency shift
-  _samplerate = src_cfg.sampleRate();
-  _fshift.setFrequencyShift(-_Fbfo);
-  _fshift.setSampleRate(_samplerate);
+  _samplerate = Fs;
+  _complexInput = complexInput;
+  _bfoChanged = false; _Fbfo = _newFbfo;
+  configMixer();
 
   // Trigger reconfig of spectrum
   configSpectrum();
 }
 
 void
-QRSS::configSpectrum()
+QRSSBase::configMixer() {
+  if (0 == _samplerate) { return; }
+  _mixInc = std::exp(std::complex<float>(0, -2*M_PI*_Fbfo/_samplerate));
+}
+
+void
+QRSSBase::configSpectrum()
 {
   // Skip config on incomplete data
   if (0 == _samplerate) { return; }
@@ -69,6 +181,8 @@ QRSS::configSpectrum()
   // Compute sub-sampling
   _subsample = _samplerate/_width;
   _curr_avg = 0; _avg_count = 0; _N_fft = 0;
+  // Average and scale the input at once
+  _avg_scale = _scale/_subsample;
 
   // Compute samples per spectrum with FFT period dotlen/2
   _N_fft = _dotlen*_samplerate/(2*_subsample);
@@ -80,6 +194,11 @@ QRSS::configSpectrum()
   if (0 != _fft) { delete _fft; }
   _fft = new FFTPlan<float>(_fft_in, _fft_out, FFT::FORWARD);
 
+  // Configure additional resolutions
+  for (size_t i=0; i<_resolutions.size(); i++) {
+    _resolutions[i]->config(_samplerate, _subsample);
+  }
+
   LogMessage msg(LOG_DEBUG);
   msg << "Configure QRSS node:" << std::endl
       << " F_bfo: " << _Fbfo << std::endl
@@ -96,63 +215,58 @@ QRSS::configSpectrum()
 
 
 void
-QRSS::process(const Buffer<int16_t> &buffer, bool allow_overwrite) {
-  for (size_t i=0; i<buffer.size(); i++)
-  {
-    // Shift frequency and sub-sample by 16 (for spectrum)
-    _curr_avg += _fshift.applyFrequencyShift(buffer[i]); _avg_count++;
-    if (_subsample == _avg_count) {
-      _fft_in[_fft_count] = _curr_avg/float( _subsample * (1<<15) );
-      _curr_avg=0; _avg_count=0; _fft_count++;
-    }
-
-    // If _N_fft samples have been received -> update spectrum
-    if (_N_fft == _fft_count) {
-      _fft_count = 0;
-      // Compute FFT
-      (*_fft)();
-      // Compute PSD
-      for (size_t j=0; j<_N_fft; j++) {
-        _currPSD[j] = _fft_out[j].real()*_fft_out[j].real()
-            + _fft_out[j].imag()*_fft_out[j].imag();
-      }
-
-      // Notify spectrum views about the new spectrum.
-      emit spectrumUpdated();
-    }
+QRSSBase::updateSpectrum() {
+  _fft_count = 0;
+  // Compute FFT
+  (*_fft)();
+  // Compute PSD
+  for (size_t j=0; j<_N_fft; j++) {
+    _currPSD[j] = _fft_out[j].real()*_fft_out[j].real()
+        + _fft_out[j].imag()*_fft_out[j].imag();
   }
+
+  // Notify spectrum views about the new spectrum.
+  emit spectrumUpdated();
 }
 
 
 double
-QRSS::Fbfo() const {
-  return _Fbfo;
+QRSSBase::Fbfo() const {
+  return _newFbfo;
+}
+
+void
+QRSSBase::setFbfo(double F) {
+  // Applied by the processing thread on the next buffer
+  _newFbfo = F;
+  _bfoChanged = true;
 }
 
 void
-QRSS::setFbfo(double F) {
-  _Fbfo = F;
-  _fshift.setFrequencyShift(-F);
+QRSSBase::applyFbfo() {
+  // Only the mixer depends on the BFO frequency
+  _Fbfo = _newFbfo;
+  configMixer();
 }
 
 double
-QRSS::dotLength() const {
+QRSSBase::dotLength() const {
   return _dotlen;
 }
 
 void
-QRSS::setDotLength(double len) {
+QRSSBase::setDotLength(double len) {
   _dotlen = len;
   configSpectrum();
 }
 
 double
-QRSS::width() const {
+QRSSBase::width() const {
   return _width;
 }
 
 void
-QRSS::setWidth(double width) {
+QRSSBase::setWidth(double width) {
   _width = width;
   configSpectrum();
 }
@@ -3,12 +3,88 @@
 
 #include <freqshift.hh>
 #include <gui/spectrum.hh>
+#include "sample.hh"
+#include <vector>
+#include <atomic>
 
 
 namespace sdr {
 
-/** Spectrum provider, extracts a spectrum +/- width (Hz) around the specified BFO frequency. */
-class QRSS: public gui::SpectrumProvider, public sdr::Sink<int16_t>
+/** An additional resolution of a @c QRSS node. It runs its own FFT on the frequency shifted and
+ * sub-sampled stream of the node, hence additional resolutions only cost their FFTs. */
+class QRSSResolution: public gui::SpectrumProvider
+{
+  Q_OBJECT
+
+public:
+  /** Constructor.
+   * @param dotlen Specifies the "dot length" in s, see @c QRSSBase.
+   * @param hop Specifies the FFT hop size as a fraction of the FFT length. 1 means no overlap,
+   *        0.5 means an overlap of half the FFT length. */
+  QRSSResolution(double dotlen, double hop=1);
+  /** Destructor. */
+  virtual ~QRSSResolution();
+
+  /** Implements the SpectrumProvider interface. */
+  bool isInputReal() const;
+  /** Implements the SpectrumProvider interface. */
+  double sampleRate() const;
+  /** Implements the SpectrumProvider interface. */
+  size_t fftSize() const;
+  /** Implements the SpectrumProvider interface. */
+  const Buffer<double> & spectrum() const;
+
+  /** Returns the dot length in s. */
+  double dotLength() const;
+  /** Returns the hop size as a fraction of the FFT length. */
+  double hop() const;
+
+  /** (Re-) Configures the FFT for the given input sample rate and sub-sample factor. */
+  void config(double Fs, size_t subsample);
+
+  /** Receives a frequency shifted and sub-sampled value. */
+  inline void put(const std::complex<float> &value) {
+    _buffer[_count++] = value;
+    if (_N_fft == _count) { updateSpectrum(); }
+  }
+
+protected:
+  /** Computes the spectrum from the collected samples. */
+  void updateSpectrum();
+
+protected:
+  /** Length of the QRSS dot. */
+  double _dotlen;
+  /** Hop size as a fraction of the FFT length. */
+  double _hop;
+  /** The input sample rate. */
+  double _samplerate;
+  /** Size of the FFT. */
+  size_t _N_fft;
+  /** Number of samples the FFT window advances. */
+  size_t _N_hop;
+  /** Number of samples in @c _buffer. */
+  size_t _count;
+  /** The collected samples. */
+  std::vector< std::complex<float> > _buffer;
+  /** The fft input buffer. */
+  Buffer< std::complex<float> > _fft_in;
+  /** The output buffer of the FFT. */
+  Buffer< std::complex<float> > _fft_out;
+  /** The FFT plan. */
+  FFTPlan<float> *_fft;
+  /** The current PSD. */
+  Buffer<double> _currPSD;
+};
+
+
+/** Spectrum provider, extracts a spectrum +/- width (Hz) around the specified BFO frequency.
+ * This class implements everything but the input, see @c QRSS.
+ *
+ * The input is shifted by -Fbfo, sub-sampled to the spectrum width and transformed by a (short)
+ * complex FFT. Additional resolutions (see @c addResolution) share the frequency shift and
+ * sub-sampling. */
+class QRSSBase: public gui::SpectrumProvider
 {
   Q_OBJECT
 
@@ -18,10 +94,11 @@ public:
    * @param dotlen Specifies "dot length" in s. Each FFT frame will be obtained from @c Fs*dotlen/2
    *        samples. Hence by increasing the dot length, the frequency resolution will be
    *        increased.
-   * @param width Specifies the width of the visible spectrum round the BFO frequency in Hz. */
-  QRSS(double Fbfo=800, double dotlen=3, double width=200);
+   * @param width Specifies the width of the visible spectrum round the BFO frequency in Hz.
+   * @param scale Specifies the scale of the input samples, see @c SampleTraits. */
+  QRSSBase(double Fbfo, double dotlen, double width, float scale);
   /** Destructor. */
-  virtual ~QRSS();
+  virtual ~QRSSBase();
 
   /** Implements the SpectrumProvider interface. */
   bool isInputReal() const;
@@ -32,11 +109,6 @@ public:
   /** Implements the SpectrumProvider interface. */
   const Buffer<double> & spectrum() const;
 
-  /** Configures the node. */
-  virtual void config(const Config &src_cfg);
-  /** Processes the given buffer. */
-  virtual void process(const Buffer<int16_t> &buffer, bool allow_overwrite);
-
   /** Returns the BFO frequency. */
   double Fbfo() const;
   /** Sets the BFO frequency. */
@@ -51,23 +123,72 @@ public:
   /** Sets the spectrum width in Hz. */
   void setWidth(double width);
 
+  /** Adds a resolution with the given dot length (s) and hop size (fraction of the FFT length).
+   * The returned spectrum provider is owned by this node. Must not be called while the node
+   * is processing. */
+  QRSSResolution *addResolution(double dotlen, double hop=1);
+  /** Returns the number of additional resolutions. */
+  size_t numResolutions() const;
+  /** Returns the specified additional resolution. */
+  QRSSResolution *resolution(size_t idx);
+
 protected:
+  /** Configures the input sample rate and type. */
+  void configInput(double Fs, bool complexInput);
   /** (Re-) Configures the spectrum. */
   void configSpectrum();
+  /** (Re-) Configures the mixer. */
+  void configMixer();
+  /** Applies a changed BFO frequency, called from the processing thread. */
+  void applyFbfo();
+
+  /** Shifts, sub-samples and analyzes the given (real or complex) input samples. */
+  template <class Scalar>
+  inline void processSamples(const Scalar *samples, size_t N) {
+    for (size_t i=0; i<N; i++) {
+      // Shift frequency and sub-sample (for spectrum)
+      _curr_avg += mixSample(_mixPhase, samples[i]); _mixPhase *= _mixInc; _avg_count++;
+      if (_subsample == _avg_count) {
+        std::complex<float> value = _curr_avg*_avg_scale;
+        _fft_in[_fft_count] = value;
+        for (size_t r=0; r<_resolutions.size(); r++) { _resolutions[r]->put(value); }
+        _curr_avg=0; _avg_count=0; _fft_count++;
+        // If _N_fft samples have been received -> update spectrum
+        if (_N_fft == _fft_count) { updateSpectrum(); }
+      }
+    }
+    // Avoid drift of the mixer amplitude
+    _mixPhase /= std::abs(_mixPhase);
+  }
+
+  /** Computes the spectrum from the collected samples. */
+  void updateSpectrum();
 
 protected:
   /** BFO frequency. */
   double _Fbfo;
+  /** BFO frequency set by @c setFbfo, applied by the processing thread. */
+  std::atomic<double> _newFbfo;
+  /** If @c true, the BFO frequency has been changed. */
+  std::atomic<bool> _bfoChanged;
   /** Length of the QRSS dot. */
   double _dotlen;
   /** Width of the spectrum. */
   double _width;
   /** The current input sample-rate. */
   double _samplerate;
-  /** Removes the _Fbfo from the input signal. */
-  FreqShiftBase<int16_t> _fshift;
+  /** If @c true, the input is complex. */
+  bool _complexInput;
+  /** The scale of the input samples. */
+  float _scale;
+  /** Phase increment of the mixer, removes the _Fbfo from the input signal. */
+  std::complex<float> _mixInc;
+  /** Phase of the mixer. */
+  std::complex<float> _mixPhase;
   /** Sub-sample factor. */
   size_t _subsample;
+  /** Scales the sum of the down-sampler to the average of the scaled input. */
+  float _avg_scale;
   /** Current average value of the down-sampler. */
   std::complex<float> _curr_avg;
   /** Current average count of the down-sampler. */
@@ -85,6 +206,67 @@ protected:
   FFTPlan<float> *_fft;
   /** The current PSD. */
   Buffer<double> _currPSD;
+
+  /** The additional resolutions. */
+  std::vector<QRSSResolution *> _resolutions;
+};
+
+
+/** The QRSS node for the given input sample type. The node accepts real (@c Scalar) and complex
+ * (@c std::complex<Scalar>) input. The latter is mixed and decimated directly, hence IQ sources
+ * do not need to be demodulated first. */
+template <class Scalar>
+class QRSS: public QRSSBase, public sdr::SinkBase
+{
+public:
+  /** Constructor.
+   * @param Fbfo Specifies the BFO frequency in Hz.
+   * @param dotlen Specifies "dot length" in s.
+   * @param width Specifies the width of the visible spectrum round the BFO frequency in Hz. */
+  QRSS(double Fbfo=800, double dotlen=3, double width=200)
+    : QRSSBase(Fbfo, dotlen, width, SampleTraits<Scalar>::scale()), sdr::SinkBase()
+  {
+    // pass...
+  }
+
+  /** Destructor. */
+  virtual ~QRSS() {
+    // pass...
+  }
+
+  /** Configures the node. */
+  virtual void config(const Config &src_cfg) {
+    // Requires type, sample-rate and buffer size
+    if (!src_cfg.hasType() || ! src_cfg.hasSampleRate() || !src_cfg.hasBufferSize()) { return; }
+
+    // check buffer type
+    if ((Config::typeId<Scalar>() != src_cfg.type()) &&
+        (Config::typeId< std::complex<Scalar> >() != src_cfg.type())) {
+      ConfigError err;
+      err << "Can not configure QRSS node: Invalid buffer type " << src_cfg.type()
+          << ", expected " << Config::typeId<Scalar>() << " or "
+          << Config::typeId< std::complex<Scalar> >();
+      throw err;
+    }
+
+    configInput(src_cfg.sampleRate(),
+                Config::typeId< std::complex<Scalar> >() == src_cfg.type());
+  }
+
+  /** Processes the given buffer. */
+  virtual void handleBuffer(const RawBuffer &buffer, bool allow_overwrite) {
+    if (_bfoChanged.exchange(false)) { applyFbfo(); }
+    if (_complexInput) {
+      Buffer< std::complex<Scalar> > input(buffer);
+      processSamples(reinterpret_cast<const std::complex<Scalar> *>(input.data()), input.size());
+    } else {
+      Buffer<Scalar> input(buffer);
+      processSamples(reinterpret_cast<const Scalar *>(input.data()), input.size());
+    }
+  }
+
+  /** Returns @c true if the node is configured for complex input. */
+  inline bool isInputComplex() const { return _complexInput; }
 };
 
 
@@ -0,0 +1,161 @@
+#include "realtime.hh"
+#include <algorithm>
+#include <logger.hh>
+#include <sched.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/mman.h>
+
+using namespace sdr;
+
+
+/* ********************************************************************************************* *
+ * Implementation of ThreadPolicy
+ * ********************************************************************************************* */
+ThreadPolicy::ThreadPolicy(int cpu, Policy policy, int priority)
+  : cpu(cpu), policy(policy), priority(priority)
+{
+  // pass...
+}
+
+bool
+ThreadPolicy::isDefault() const {
+  return (0 > cpu) && (POLICY_DEFAULT == policy);
+}
+
+bool
+ThreadPolicy::apply() const {
+  bool success = true;
+
+  if (0 <= cpu) {
+#ifdef __linux__
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus); CPU_SET(cpu, &cpus);
+    int err = pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpus);
+    if (0 != err) {
+      LogMessage msg(LOG_WARNING);
+      msg << "Can not pin processing thread to CPU " << cpu << ": " << strerror(err);
+      Logger::get().log(msg);
+      success = false;
+    }
+#else
+    LogMessage msg(LOG_WARNING);
+    msg << "Pinning threads to CPUs is not supported on this platform.";
+    Logger::get().log(msg);
+    success = false;
+#endif
+  }
+
+  if (POLICY_DEFAULT != policy) {
+    int sched = (POLICY_FIFO == policy) ? SCHED_FIFO : SCHED_RR;
+    struct sched_param param;
+    param.sched_priority = std::max(sched_get_priority_min(sched),
+                                    std::min(sched_get_priority_max(sched), priority));
+    int err = pthread_setschedparam(pthread_self(), sched, &param);
+    if (0 != err) {
+      LogMessage msg(LOG_WARNING);
+      msg << "Can not set real-time scheduling (" << ((SCHED_FIFO == sched) ? "FIFO" : "RR")
+          << ", priority " << param.sched_priority << "): " << strerror(err)
+          << ". Keep default scheduling.";
+      Logger::get().log(msg);
+      success = false;
+    }
+  }
+
+  return success;
+}
+
+ThreadPolicy::Policy
+ThreadPolicy::policyFromName(const std::string &name) {
+  if ("fifo" == name) { return POLICY_FIFO; }
+  if ("rr" == name) { return POLICY_RR; }
+  return POLICY_DEFAULT;
+}
+
+
+bool
+sdr::lockMemory() {
+  if (0 != mlockall(MCL_CURRENT | MCL_FUTURE)) {
+    LogMessage msg(LOG_WARNING);
+    msg << "Can not lock memory: " << strerror(errno);
+    Logger::get().log(msg);
+    return false;
+  }
+  return true;
+}
+
+
+/* ********************************************************************************************* *
+ * Implementation of DeadlineMonitor
+ * ********************************************************************************************* */
+DeadlineMonitor::DeadlineMonitor()
+  : Proxy(), _blockDuration(0), _policy(), _applyPolicy(false), _thread(),
+    _blocks(0), _misses(0), _loadSum(0), _loadMax(0)
+{
+  // pass...
+}
+
+DeadlineMonitor::~DeadlineMonitor() {
+  // pass...
+}
+
+void
+DeadlineMonitor::setThreadPolicy(const ThreadPolicy &policy) {
+  _policy = policy;
+  _applyPolicy = ! policy.isDefault();
+}
+
+void
+DeadlineMonitor::config(const Config &src_cfg) {
+  // Requires sample-rate and buffer size
+  if (src_cfg.hasSampleRate() && src_cfg.hasBufferSize()) {
+    _blockDuration = 1e9*src_cfg.bufferSize()/src_cfg.sampleRate();
+    reset();
+  }
+  // Pass on
+  Proxy::config(src_cfg);
+}
+
+void
+DeadlineMonitor::handleBuffer(const RawBuffer &buffer, bool allow_overwrite) {
+  // (Re-) apply policy if the chain is processed by another thread
+  if (_applyPolicy && ((0 == _blocks) || (! pthread_equal(_thread, pthread_self())))) {
+    _thread = pthread_self();
+    _policy.apply();
+  }
+
+  int64_t start = monotonicNs();
+  this->send(buffer, allow_overwrite);
+  double load = 0;
+  if (0 < _blockDuration) { load = (monotonicNs()-start)/_blockDuration; }
+
+  _blocks++; _loadSum += load;
+  _loadMax = std::max(_loadMax, load);
+  if (1 < load) { _misses++; }
+}
+
+size_t
+DeadlineMonitor::blocks() const {
+  return _blocks;
+}
+
+size_t
+DeadlineMonitor::misses() const {
+  return _misses;
+}
+
+double
+DeadlineMonitor::meanLoad() const {
+  if (0 == _blocks) { return 0; }
+  return _loadSum/_blocks;
+}
+
+double
+DeadlineMonitor::maxLoad() const {
+  return _loadMax;
+}
+
+void
+DeadlineMonitor::reset() {
+  _blocks = 0; _misses = 0; _loadSum = 0; _loadMax = 0;
+}
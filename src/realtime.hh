@@ -0,0 +1,125 @@
+#ifndef __SDR_QRSS_REALTIME_HH__
+#define __SDR_QRSS_REALTIME_HH__
+
+#include <node.hh>
+#include <pthread.h>
+#include <stdint.h>
+#include <string>
+#include <time.h>
+
+
+namespace sdr {
+
+/** Returns the current time of the monotonic clock in ns. */
+inline int64_t monotonicNs() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return int64_t(ts.tv_sec)*1000000000LL + ts.tv_nsec;
+}
+
+
+/** Scheduling settings of a processing thread. */
+class ThreadPolicy
+{
+public:
+  /** Possible scheduling policies. */
+  typedef enum {
+    POLICY_DEFAULT,  ///< Keep the default (time-sharing) scheduling.
+    POLICY_FIFO,     ///< Real-time first-in first-out scheduling (SCHED_FIFO).
+    POLICY_RR        ///< Real-time round-robin scheduling (SCHED_RR).
+  } Policy;
+
+public:
+  /** Constructor.
+   * @param cpu Specifies the CPU the thread is pinned to, -1 means no pinning.
+   * @param policy Specifies the scheduling policy.
+   * @param priority Specifies the real-time priority, clamped to the range of the policy. */
+  ThreadPolicy(int cpu=-1, Policy policy=POLICY_DEFAULT, int priority=0);
+
+  /** Returns @c true if the policy changes anything. */
+  bool isDefault() const;
+
+  /** Applies the policy to the calling thread. Settings that can not be applied (e.g., real-time
+   * scheduling without the required privileges) are logged and skipped, the thread keeps
+   * running with the default settings. Returns @c true if everything was applied. */
+  bool apply() const;
+
+  /** Parses a policy name ("default", "fifo" or "rr"). */
+  static Policy policyFromName(const std::string &name);
+
+public:
+  /** The CPU to pin the thread to or -1. */
+  int cpu;
+  /** The scheduling policy. */
+  Policy policy;
+  /** The real-time priority. */
+  int priority;
+};
+
+
+/** Locks all current and future pages of the process into RAM, hence the processing never
+ * waits for the pager. Failures (e.g., missing privileges) are logged, returns @c true on
+ * success. */
+bool lockMemory();
+
+
+/** Measures the processing time of each block passed through this node against the duration of
+ * the block.
+ *
+ * The node is inserted at the head of a processing chain, all sinks must be connected directly.
+ * Then the time spent in @c handleBuffer is the time the chain needs to process a block. If that
+ * time exceeds the duration of the block (its size divided by the sample rate), the deadline is
+ * missed and the chain can not keep up in real time. The block duration is obtained from the
+ * configured buffer size and sample rate.
+ *
+ * The node also applies a @c ThreadPolicy to the thread processing the chain, once per
+ * thread. */
+class DeadlineMonitor: public Proxy
+{
+public:
+  /** Constructor. */
+  DeadlineMonitor();
+  /** Destructor. */
+  virtual ~DeadlineMonitor();
+
+  /** Sets the policy of the processing thread, applied on the next block. */
+  void setThreadPolicy(const ThreadPolicy &policy);
+
+  /** Configures the node. */
+  virtual void config(const Config &src_cfg);
+  /** Passes the buffer to the connected sinks and accounts the processing time. */
+  virtual void handleBuffer(const RawBuffer &buffer, bool allow_overwrite);
+
+  /** Returns the number of processed blocks. */
+  size_t blocks() const;
+  /** Returns the number of blocks that missed their deadline. */
+  size_t misses() const;
+  /** Returns the mean processing time relative to the block duration. */
+  double meanLoad() const;
+  /** Returns the maximum processing time relative to the block duration. */
+  double maxLoad() const;
+  /** Resets the statistics. */
+  void reset();
+
+protected:
+  /** The duration of a block in ns. */
+  double _blockDuration;
+  /** The policy of the processing thread. */
+  ThreadPolicy _policy;
+  /** If @c true, the policy needs to be applied. */
+  bool _applyPolicy;
+  /** The thread, the policy was applied to last. */
+  pthread_t _thread;
+  /** Number of processed blocks. */
+  size_t _blocks;
+  /** Number of missed deadlines. */
+  size_t _misses;
+  /** Sum of the relative processing times. */
+  double _loadSum;
+  /** Maximum relative processing time. */
+  double _loadMax;
+};
+
+}
+
+#endif // __SDR_QRSS_REALTIME_HH__
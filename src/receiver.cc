@@ -1,5 +1,6 @@
 #include "receiver.hh"
 #include <QLabel>
+#include <algorithm>
 
 
 /* ********************************************************************************************* *
@@ -15,6 +16,11 @@ QRSSSource::~QRSSSource() {
   // pass...
 }
 
+bool
+QRSSSource::isComplex() const {
+  return false;
+}
+
 void
 QRSSSource::setBFOFrequency(double F) {
   _Fbfo = F;
@@ -32,14 +38,11 @@ QRSSSource::setSpectrumWidth(double width) {
 AudioSource::AudioSource(double Fbfo, double width, QObject *parent)
   : QRSSSource(Fbfo, width, parent), _src(16e3, 256), _ctrlView(0)
 {
-  // Connect to idle signal of queue
-  sdr::Queue::get().addIdle(&_src, &sdr::PortSource<int16_t>::next);
+  // pass...
 }
 
 AudioSource::~AudioSource()
 {
-  // unregister idle callbacks
-  sdr::Queue::get().remIdle(&_src);
   if (0 != _ctrlView) {
     // delete ctrl view later
     _ctrlView->deleteLater();
@@ -60,6 +63,17 @@ AudioSource::view() {
   return _ctrlView;
 }
 
+void
+AudioSource::start() {
+  _src.start();
+}
+
+void
+AudioSource::stop() {
+  _src.stop();
+  _src.wait();
+}
+
 void
 AudioSource::onViewDeleted() {
   _ctrlView = 0;
@@ -70,51 +84,206 @@ AudioSource::onViewDeleted() {
  * Implementation of IQAudioSource
  * ********************************************************************************************* */
 IQAudioSource::IQAudioSource(double Fbfo, double width, QObject *parent)
-  : QRSSSource(Fbfo, width, parent), _src(16e3, 256), _filter(0, Fbfo, width, 31, 1), _demod(),
-    _ctrlView(0)
+  : QRSSSource(Fbfo, width, parent), _src(16e3, 256), _ctrlView(0)
 {
-  sdr::Queue::get().addIdle(&_src, &sdr::PortSource< std::complex<int16_t> >::next);
-  _src.connect(&_filter, true);
-  _filter.connect(&_demod, true);
+  // pass...
 }
 
 IQAudioSource::~IQAudioSource() {
-  // unregister idle callbacks
-  sdr::Queue::get().remIdle(&_src);
   if (0 != _ctrlView) {
     // delete ctrl view later
     _ctrlView->deleteLater();
   }
 }
 
+sdr::Source *
+IQAudioSource::source() {
+  return &_src;
+}
+
+bool
+IQAudioSource::isComplex() const {
+  return true;
+}
+
+QWidget *
+IQAudioSource::view() {
+  if (0 == _ctrlView) {
+    _ctrlView = new QLabel("No settings for IQ audio source.");
+    QObject::connect(_ctrlView, SIGNAL(destroyed()), this, SLOT(onViewDeleted()));
+  }
+  return _ctrlView;
+}
+
+void
+IQAudioSource::start() {
+  _src.start();
+}
+
 void
-IQAudioSource::setBFOFrequency(double F) {
-  QRSSSource::setBFOFrequency(F);
-  _filter.setFilterFrequency(F);
+IQAudioSource::stop() {
+  _src.stop();
+  _src.wait();
 }
 
 void
-IQAudioSource::setSpectrumWidth(double width) {
-  QRSSSource::setSpectrumWidth(width);
-  _filter.setFilterWidth(width);
+IQAudioSource::onViewDeleted() {
+  _ctrlView = 0;
+}
+
+
+/* ********************************************************************************************* *
+ * Implementation of ChannelAudioSource
+ * ********************************************************************************************* */
+ChannelAudioSource::ChannelAudioSource(size_t channel, size_t channels, double Fbfo, double width,
+                                       QObject *parent)
+  : QRSSSource(Fbfo, width, parent), _channel(channel),
+    _device(sdr::MultiChannelAudioSource::acquire(16e3, 256, channels)), _ctrlView(0)
+{
+  // pass...
+}
+
+ChannelAudioSource::~ChannelAudioSource() {
+  sdr::MultiChannelAudioSource::release();
+  if (0 != _ctrlView) {
+    // delete ctrl view later
+    _ctrlView->deleteLater();
+  }
 }
 
 sdr::Source *
-IQAudioSource::source() {
-  return &_demod;
+ChannelAudioSource::source() {
+  return _device->channel(_channel);
 }
 
 QWidget *
-IQAudioSource::view() {
+ChannelAudioSource::view() {
   if (0 == _ctrlView) {
-    _ctrlView = new QLabel("No settings for IQ audio source.");
+    _ctrlView = new QLabel(QString("Channel %1 of %2.").arg(_channel).arg(_device->numChannels()));
     QObject::connect(_ctrlView, SIGNAL(destroyed()), this, SLOT(onViewDeleted()));
   }
   return _ctrlView;
 }
 
 void
-IQAudioSource::onViewDeleted() {
+ChannelAudioSource::start() {
+  _device->startChannel(_channel);
+}
+
+void
+ChannelAudioSource::stop() {
+  // The channel is processed by its own worker, the device keeps running for the other channels
+  _device->stopChannel(_channel);
+}
+
+void
+ChannelAudioSource::onViewDeleted() {
+  _ctrlView = 0;
+}
+
+
+/* ********************************************************************************************* *
+ * Implementation of SyntheticSource
+ * ********************************************************************************************* */
+SyntheticSource::SyntheticSource(QSettings &settings, double Fbfo, double width, double dotLength,
+                                 QObject *parent)
+  : QRSSSource(Fbfo, width, parent), _real(0), _complex(0), _generator(0), _paced(true),
+    _ctrlView(0)
+{
+  settings.beginGroup("synthetic");
+  double Fs = settings.value("sampleRate", 16e3).toDouble();
+  size_t bufferSize = settings.value("bufferSize", 256).toUInt();
+  double noiseLevel = settings.value("noiseLevel", -60.0).toDouble();
+  uint32_t seed = settings.value("seed", 1).toUInt();
+  _paced = settings.value("paced", true).toBool();
+  if (settings.value("complex", false).toBool()) {
+    _complex = new sdr::GeneratorSource< std::complex<sdr::Sample> >(
+          Fs, bufferSize, _paced, noiseLevel, seed);
+    _generator = &_complex->generator();
+  } else {
+    _real = new sdr::GeneratorSource<sdr::Sample>(Fs, bufferSize, _paced, noiseLevel, seed);
+    _generator = &_real->generator();
+  }
+
+  int nBeacons = settings.beginReadArray("beacons");
+  for (int i=0; i<nBeacons; i++) {
+    settings.setArrayIndex(i);
+    _generator->addBeacon(sdr::QRSSGenerator::Beacon(
+                            sdr::QRSSGenerator::modeFromName(
+                              settings.value("mode", "cw").toString().toStdString()),
+                            settings.value("frequency", Fbfo).toDouble(),
+                            settings.value("text", "QRSS").toString().toStdString(),
+                            settings.value("dotLength", dotLength).toDouble(),
+                            settings.value("level", -40.0).toDouble(),
+                            settings.value("shift", 5.0).toDouble(),
+                            settings.value("drift", 0.0).toDouble(),
+                            settings.value("fadingPeriod", 0.0).toDouble(),
+                            settings.value("fadingDepth", 0.0).toDouble()));
+  }
+  settings.endArray();
+
+  // Without explicit beacons, spread numBeacons CW, FSK-CW and DFCW beacons over the band
+  if (0 == nBeacons) {
+    nBeacons = settings.value("numBeacons", 3).toInt();
+    for (int i=0; i<nBeacons; i++) {
+      double F = Fbfo + 0.8*width*((i+0.5)/nBeacons - 0.5);
+      _generator->addBeacon(sdr::QRSSGenerator::Beacon(
+                              sdr::QRSSGenerator::Mode(i%3), F, "QRSS", dotLength));
+    }
+  }
+  settings.endGroup();
+}
+
+SyntheticSource::~SyntheticSource() {
+  if (_real) { delete _real; }
+  if (_complex) { delete _complex; }
+  if (0 != _ctrlView) {
+    // delete ctrl view later
+    _ctrlView->deleteLater();
+  }
+}
+
+sdr::Source *
+SyntheticSource::source() {
+  if (_complex) { return _complex; }
+  return _real;
+}
+
+bool
+SyntheticSource::isComplex() const {
+  return (0 != _complex);
+}
+
+sdr::QRSSGenerator &
+SyntheticSource::generator() {
+  return *_generator;
+}
+
+QWidget *
+SyntheticSource::view() {
+  if (0 == _ctrlView) {
+    _ctrlView = new QLabel(QString("%1 synthetic beacons at %2 Hz sample rate (%3).")
+                           .arg(_generator->numBeacons()).arg(_generator->sampleRate())
+                           .arg(_paced ? "real time" : "flat out"));
+    QObject::connect(_ctrlView, SIGNAL(destroyed()), this, SLOT(onViewDeleted()));
+  }
+  return _ctrlView;
+}
+
+void
+SyntheticSource::start() {
+  if (_complex) { _complex->start(); }
+  else { _real->start(); }
+}
+
+void
+SyntheticSource::stop() {
+  if (_complex) { _complex->stop(); _complex->wait(); }
+  else { _real->stop(); _real->wait(); }
+}
+
+void
+SyntheticSource::onViewDeleted() {
   _ctrlView = 0;
 }
 
@@ -122,32 +291,113 @@ IQAudioSource::onViewDeleted() {
 /* ********************************************************************************************* *
  * Implementation of Receiver
  * ********************************************************************************************* */
-Receiver::Receiver(QObject *parent) :
-  QObject(parent), _sourceType(AUDIO_SOURCE), _source(0), _agc(0.1, 10e3), _qrss(800, 3, 300), _monitor(true),
+Receiver::Receiver(int channel, QObject *parent) :
+  QObject(parent), _channel(channel), _numChannels(2), _sourceType(AUDIO_SOURCE), _source(0),
+  _deadlines(), _agc(0.1, 10e3*sdr::SampleTraits<sdr::Sample>::fullScale()/(1<<15)),
+  _iqAgc(0.1, 10e3*sdr::SampleTraits<sdr::Sample>::fullScale()/(1<<15)), _qrss(800, 3, 300),
+  _history(0), _monitor(true),
   _audioSink(), _settings("com.github.hmatuschek", "sdr-qrss")
 {
+  // Receivers bound to a channel keep their settings in a separate group
+  _numChannels = std::max(2, _settings.value("channels", 1).toInt());
+  if (0 <= _channel) {
+    _numChannels = std::max(int(_numChannels), _channel+1);
+    _sourceType = CHANNEL_AUDIO_SOURCE;
+    _settings.beginGroup(QString("channel%1").arg(_channel));
+  }
+
+  // Config processing thread: CPU pinning, scheduling policy and priority
+  _deadlines.setThreadPolicy(
+        sdr::ThreadPolicy(_settings.value("cpu", -1).toInt(),
+                          sdr::ThreadPolicy::policyFromName(
+                            _settings.value("schedPolicy", "default").toString().toStdString()),
+                          _settings.value("schedPriority", 50).toInt()));
+  if (_settings.value("lockMemory", false).toBool()) {
+    sdr::lockMemory();
+  }
+
   // Config AGC
   _agc.enable(_settings.value("agc", false).toBool());
   _agc.setGain(_settings.value("gain", 1.0).toDouble());
+  _iqAgc.enable(_agc.enabled());
+  _iqAgc.setGain(_agc.gain());
 
   // Config QRSS node
   _qrss.setFbfo(_settings.value("Fbfo", 800.0).toDouble());
   _qrss.setDotLength(_settings.value("dotLength", 3.0).toDouble());
   _qrss.setWidth(_settings.value("width", 300.0).toDouble());
+  // Additional resolutions sharing the sub-sampled stream, each given as "dotlen[:hop]" with
+  // the dot length in s and the hop size as a fraction of the FFT length
+  QStringList resolutions = _settings.value("resolutions").toStringList();
+  for (int i=0; i<resolutions.size(); i++) {
+    QStringList res = resolutions[i].split(':');
+    _qrss.addResolution(res[0].toDouble(), (res.size() > 1) ? res[1].toDouble() : 1.0);
+  }
+  // Scrollback history (disabled by default), memory budget in MB
+  if (_settings.value("history", false).toBool()) {
+    _history = new sdr::SpectrumHistory(
+          &_qrss, size_t(_settings.value("historyBudget", 64).toDouble()*(1<<20)));
+  }
 
   // Config monitor
   _monitor = _settings.value("monitor", true).toBool();
+  _audioSink.setFbfo(_qrss.Fbfo());
+  _audioSink.setWidth(_qrss.width());
+  _audioSink.setBandLimited(_settings.value("monitorBandLimited", false).toBool());
+  _audioSink.setEnabled(_monitor);
 
-  _source = new AudioSource(_qrss.Fbfo(), _qrss.width());
-  _source->source()->connect(&_agc);
-  _agc.connect(&_qrss, true);
-  if (_monitor) {
-    _agc.connect(&_audioSink, true);
-  }
+  _source = createSource();
+  connectSource();
 }
 
 Receiver::~Receiver() {
-  if (0 != _source) { delete _source; }
+  if (0 != _history) { delete _history; }
+  if (0 != _source) {
+    _source->source()->disconnect(&_deadlines);
+    delete _source;
+  }
+}
+
+int
+Receiver::channel() const {
+  return _channel;
+}
+
+QRSSSource *
+Receiver::createSource() {
+  switch (_sourceType) {
+  case AUDIO_SOURCE:
+    return new AudioSource(_qrss.Fbfo(), _qrss.width());
+  case IQ_AUDIO_SOURCE:
+    return new IQAudioSource(_qrss.Fbfo(), _qrss.width());
+  case CHANNEL_AUDIO_SOURCE:
+    return new ChannelAudioSource(std::max(0, _channel), _numChannels, _qrss.Fbfo(), _qrss.width());
+  case SYNTHETIC_SOURCE:
+    return new SyntheticSource(_settings, _qrss.Fbfo(), _qrss.width(), _qrss.dotLength());
+  }
+  return 0;
+}
+
+void
+Receiver::connectSource() {
+  _agc.disconnect(&_qrss); _agc.disconnect(&_audioSink);
+  _iqAgc.disconnect(&_qrss); _iqAgc.disconnect(&_audioSink);
+
+  _deadlines.disconnect(&_agc); _deadlines.disconnect(&_iqAgc);
+
+  // IQ sources are passed to the QRSS node without demodulation
+  _source->source()->connect(&_deadlines, true);
+  sdr::Source *agc = &_agc;
+  if (_source->isComplex()) {
+    agc = &_iqAgc;
+    _deadlines.connect(&_iqAgc, true);
+  } else {
+    _deadlines.connect(&_agc, true);
+  }
+
+  // The monitor stays connected, it is enabled/disabled by the processing thread
+  agc->connect(&_qrss, true);
+  agc->connect(&_audioSink, true);
 }
 
 Receiver::SourceType
@@ -157,16 +407,20 @@ Receiver::sourceType() const {
 
 void
 Receiver::setSourceType(SourceType source) {
+  // Only this chain gets switched, the queue and the other channels keep running
+  bool isRunning = sdr::Queue::get().isRunning();
   _sourceType = source;
-  if (0 != _source) { delete _source; }
-  switch (_sourceType) {
-  case AUDIO_SOURCE:
-    _source = new AudioSource(_qrss.Fbfo(), _qrss.width()); break;
-  case IQ_AUDIO_SOURCE:
-    _source = new IQAudioSource(_qrss.Fbfo(), _qrss.width()); break;
+  if (0 != _source) {
+    if (isRunning) { _source->stop(); }
+    // Shared sources (e.g. channels) outlive the wrapper, detach them from this chain
+    _source->source()->disconnect(&_deadlines);
+    delete _source;
   }
+  _source = createSource();
   // Connect to QRSS node
-  _source->source()->connect(&_agc);
+  connectSource();
+  // The new source missed the start of the queue
+  if (isRunning) { _source->start(); }
 }
 
 QWidget *
@@ -179,6 +433,21 @@ Receiver::spectrum() {
   return &_qrss;
 }
 
+size_t
+Receiver::numResolutions() const {
+  return _qrss.numResolutions();
+}
+
+sdr::QRSSResolution *
+Receiver::resolution(size_t idx) {
+  return _qrss.resolution(idx);
+}
+
+sdr::SpectrumHistory *
+Receiver::history() {
+  return _history;
+}
+
 double
 Receiver::bfoFrequency() const {
   return _qrss.Fbfo();
@@ -187,6 +456,7 @@ Receiver::bfoFrequency() const {
 void
 Receiver::setBFOFrequency(double F) {
   _qrss.setFbfo(F);
+  _audioSink.setFbfo(F);
   _settings.setValue("Fbfo", F);
 }
 
@@ -209,6 +479,7 @@ Receiver::spectrumWidth() const {
 void
 Receiver::setSpectrumWidth(double width) {
   _qrss.setWidth(width);
+  _audioSink.setWidth(width);
   _settings.setValue("width", width);
 }
 
@@ -220,17 +491,20 @@ Receiver::agcEnabled() const {
 void
 Receiver::enableAGC(bool enabled) {
   _agc.enable(enabled);
+  _iqAgc.enable(enabled);
   _settings.setValue("agc", enabled);
 }
 
 double
 Receiver::gain() const {
+  if (_source->isComplex()) { return _iqAgc.gain(); }
   return _agc.gain();
 }
 
 void
 Receiver::setGain(double gain) {
   _agc.setGain(gain);
+  _iqAgc.setGain(gain);
   _settings.setValue("gain", gain);
 }
 
@@ -241,12 +515,24 @@ Receiver::monitor() const {
 
 void
 Receiver::setMonitor(bool enabled) {
-  if (enabled && !_monitor) {
-    // enable monitoring
-    _agc.connect(&_audioSink, true);
-  } else if (!enabled && _monitor) {
-    _agc.disconnect(&_audioSink);
-  }
+  // Applied by the processing thread and the playback thread of the monitor
+  _audioSink.setEnabled(enabled);
   _monitor = enabled;
   _settings.setValue("monitor", enabled);
 }
+
+const sdr::DeadlineMonitor &
+Receiver::deadlines() const {
+  return _deadlines;
+}
+
+bool
+Receiver::monitorBandLimited() const {
+  return _audioSink.bandLimited();
+}
+
+void
+Receiver::setMonitorBandLimited(bool enabled) {
+  _audioSink.setBandLimited(enabled);
+  _settings.setValue("monitorBandLimited", enabled);
+}
@@ -5,6 +5,12 @@
 #include <QSettings>
 
 #include "qrss.hh"
+#include "multichannel.hh"
+#include "monitor.hh"
+#include "audioinput.hh"
+#include "realtime.hh"
+#include "history.hh"
+#include "synthetic.hh"
 #include <libsdr/baseband.hh>
 
 
@@ -23,6 +29,14 @@ public:
   virtual sdr::Source *source() = 0;
   /** Returns the control view of the source. */
   virtual QWidget *view() = 0;
+  /** Returns @c true if the source provides complex (IQ) samples. */
+  virtual bool isComplex() const;
+
+  /** Starts this source while the queue is running, e.g. after switching sources. */
+  virtual void start() = 0;
+  /** Stops this source while the queue is running. Once this method returns, nothing is sent
+   * by this source anymore and it may be deleted. */
+  virtual void stop() = 0;
 
   /** Set the BFO frequency. This method can be overridden by sub-classes to
    * update filters. */
@@ -52,13 +66,15 @@ public:
 
   virtual sdr::Source *source();
   virtual QWidget *view();
+  virtual void start();
+  virtual void stop();
 
 protected slots:
   void onViewDeleted();
 
 protected:
   /** The actual SDR audio source. */
-  sdr::PortSource<int16_t> _src;
+  sdr::AudioInput<sdr::Sample> _src;
   /** Holds a reference to the ctrl view. */
   QWidget *_ctrlView;
 };
@@ -75,22 +91,91 @@ public:
   /** Destructor. */
   virtual ~IQAudioSource();
 
-  virtual void setBFOFrequency(double F);
-  virtual void setSpectrumWidth(double width);
-
   virtual sdr::Source *source();
   virtual QWidget *view();
+  virtual bool isComplex() const;
+  virtual void start();
+  virtual void stop();
 
 protected slots:
   void onViewDeleted();
 
 protected:
   /** The audio imput source. */
-  sdr::PortSource< std::complex<int16_t> > _src;
-  /** A filter around the BFO frequency. */
-  sdr::IQBaseBand<int16_t> _filter;
-  /** A SSB demodulator. */
-  sdr::USBDemod<int16_t> _demod;
+  sdr::AudioInput< std::complex<sdr::Sample> > _src;
+  /** A reference to the ctrl view. */
+  QWidget *_ctrlView;
+};
+
+
+/** A single channel of a multi-channel sound card. All channel sources share the same device. */
+class ChannelAudioSource: public QRSSSource
+{
+  Q_OBJECT
+
+public:
+  /** Constructor.
+   * @param channel Specifies the channel index of the device.
+   * @param channels Specifies the number of channels of the device. */
+  explicit ChannelAudioSource(size_t channel, size_t channels, double Fbfo, double width,
+                              QObject *parent=0);
+  /** Destructor. */
+  virtual ~ChannelAudioSource();
+
+  virtual sdr::Source *source();
+  virtual QWidget *view();
+  virtual void start();
+  virtual void stop();
+
+protected slots:
+  void onViewDeleted();
+
+protected:
+  /** The channel index. */
+  size_t _channel;
+  /** The shared device. */
+  sdr::MultiChannelAudioSource *_device;
+  /** A reference to the ctrl view. */
+  QWidget *_ctrlView;
+};
+
+
+/** Synthetic QRSS beacons in noise, for load and accuracy tests. The generator is configured
+ * by the group "synthetic" of the given settings. */
+class SyntheticSource: public QRSSSource
+{
+  Q_OBJECT
+
+public:
+  /** Constructor.
+   * @param settings Specifies the settings holding the "synthetic" group.
+   * @param dotLength Specifies the dot length of the default beacons. */
+  explicit SyntheticSource(QSettings &settings, double Fbfo, double width, double dotLength,
+                           QObject *parent=0);
+  /** Destructor. */
+  virtual ~SyntheticSource();
+
+  virtual sdr::Source *source();
+  virtual QWidget *view();
+  virtual bool isComplex() const;
+  virtual void start();
+  virtual void stop();
+
+  /** Returns the signal generator. */
+  sdr::QRSSGenerator &generator();
+
+protected slots:
+  void onViewDeleted();
+
+protected:
+  /** The real generator source or 0. */
+  sdr::GeneratorSource<sdr::Sample> *_real;
+  /** The complex generator source or 0. */
+  sdr::GeneratorSource< std::complex<sdr::Sample> > *_complex;
+  /** The signal generator of the active source. */
+  sdr::QRSSGenerator *_generator;
+  /** If @c true, the blocks are generated in real time. */
+  bool _paced;
   /** A reference to the ctrl view. */
   QWidget *_ctrlView;
 };
@@ -104,25 +189,40 @@ class Receiver : public QObject
 public:
   /** Possible input sources. */
   typedef enum {
-    AUDIO_SOURCE,    ///< Real audio input source.
-    IQ_AUDIO_SOURCE  ///< IQ audio input source.
+    AUDIO_SOURCE,        ///< Real audio input source.
+    IQ_AUDIO_SOURCE,     ///< IQ audio input source.
+    CHANNEL_AUDIO_SOURCE, ///< A channel of a multi-channel audio input source.
+    SYNTHETIC_SOURCE     ///< Synthetic QRSS beacons.
   } SourceType;
 
 public:
-  /** Constructor. */
-  explicit Receiver(QObject *parent = 0);
+  /** Constructor.
+   * @param channel Specifies the channel of the multi-channel audio source this receiver is
+   *        attached to. If negative, the receiver uses the audio source and the global settings,
+   *        otherwise the channel source and the settings of that channel. */
+  explicit Receiver(int channel = -1, QObject *parent = 0);
   /** Destructor. */
   virtual ~Receiver();
 
+  /** Returns the channel index of this receiver or -1 if it is not bound to a channel. */
+  int channel() const;
+
   /** Returns the currenly selected input source. */
   SourceType sourceType() const;
-  /** Sets the current input source. */
+  /** Sets the current input source. If the queue is running, only the old source is stopped and
+   * the new one started, hence the receivers of the other channels keep running. */
   void setSourceType(SourceType source);
   /** Creates a control view for the current input source. */
   QWidget *sourceView();
 
   /** Returns the spectrum provider. */
   sdr::gui::SpectrumProvider *spectrum();
+  /** Returns the number of additional resolutions. */
+  size_t numResolutions() const;
+  /** Returns the spectrum provider of the specified additional resolution. */
+  sdr::QRSSResolution *resolution(size_t idx);
+  /** Returns the scrollback history of the spectrum or 0 if disabled. */
+  sdr::SpectrumHistory *history();
 
   /** Returns the current BFO frequency (Hz). */
   double bfoFrequency() const;
@@ -148,20 +248,43 @@ public:
   bool monitor() const;
   /** Enables/Disables audio monitoring. */
   void setMonitor(bool enabled);
+  /** Returns @c true if the audio monitor is limited to the band around the BFO frequency. */
+  bool monitorBandLimited() const;
+  /** Enables/Disables the band-limited audio monitor. */
+  void setMonitorBandLimited(bool enabled);
+  /** Returns the deadline accounting of the processing chain. */
+  const sdr::DeadlineMonitor &deadlines() const;
+
+protected:
+  /** Creates the source instance for the current source type. */
+  QRSSSource *createSource();
+  /** Connects the current source to the AGC matching its sample type and the AGC to the QRSS
+   * node and monitor. */
+  void connectSource();
 
 protected:
+  /** The channel index or -1. */
+  int _channel;
+  /** The number of channels of the multi-channel audio source. */
+  size_t _numChannels;
   /** The currently selected source type. */
   SourceType _sourceType;
   /** The currently selected source instance. */
   QRSSSource *_source;
-  /** The AGC/gain node. */
-  sdr::AGC<int16_t> _agc;
+  /** Deadline accounting at the head of the processing chain. */
+  sdr::DeadlineMonitor _deadlines;
+  /** The AGC/gain node for real sources. */
+  sdr::AGC<sdr::Sample> _agc;
+  /** The AGC/gain node for complex sources. */
+  sdr::AGC< std::complex<sdr::Sample> > _iqAgc;
   /** QRSS "demodulator" instance. */
-  sdr::QRSS _qrss;
+  sdr::QRSS<sdr::Sample> _qrss;
+  /** Scrollback history of the QRSS spectrum or 0. */
+  sdr::SpectrumHistory *_history;
   /** If true, audio monitoring is enabled. */
   bool _monitor;
   /** Audio monitor sink. */
-  sdr::PortSink _audioSink;
+  sdr::AudioMonitor _audioSink;
   /** Persistent settings. */
   QSettings _settings;
 };
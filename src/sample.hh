@@ -0,0 +1,83 @@
+#ifndef __SDR_QRSS_SAMPLE_HH__
+#define __SDR_QRSS_SAMPLE_HH__
+
+#include <portaudio.h>
+#include <algorithm>
+#include <complex>
+#include <stdint.h>
+
+
+namespace sdr {
+
+/** The sample type of the processing chain, selected at compile time. By default, the chain
+ * processes 16bit integers. If @c SDR_QRSS_FLOAT is defined, the chain processes 32bit floats
+ * from the sound card to the spectrum. */
+#ifdef SDR_QRSS_FLOAT
+typedef float Sample;
+#else
+typedef int16_t Sample;
+#endif
+
+
+/** Properties of the supported sample types. */
+template <class Scalar> class SampleTraits;
+
+/** Properties of 16bit integer samples. */
+template <>
+class SampleTraits<int16_t>
+{
+public:
+  /** The value of a full-scale sample. */
+  static inline float fullScale() { return (1<<15); }
+  /** Scales a sample to [-1,1]. */
+  static inline float scale() { return 1./(1<<15); }
+  /** Converts a float to a sample of the same scale, saturates. */
+  static inline int16_t fromFloat(float value) {
+    return int16_t(std::max(-32768.f, std::min(32767.f, value)));
+  }
+  /** The PortAudio sample format. */
+  static inline PaSampleFormat paFormat() { return paInt16; }
+  /** The name of the sample type. */
+  static inline const char *name() { return "int16"; }
+};
+
+/** Properties of 32bit float samples. */
+template <>
+class SampleTraits<float>
+{
+public:
+  /** The value of a full-scale sample. */
+  static inline float fullScale() { return 1; }
+  /** Scales a sample to [-1,1]. */
+  static inline float scale() { return 1; }
+  /** Converts a float to a sample of the same scale. */
+  static inline float fromFloat(float value) { return value; }
+  /** The PortAudio sample format. */
+  static inline PaSampleFormat paFormat() { return paFloat32; }
+  /** The name of the sample type. */
+  static inline const char *name() { return "float32"; }
+};
+
+
+/** Multiplies the mixer phase @c phase with a real sample. */
+inline std::complex<float> mixSample(const std::complex<float> &phase, int16_t value) {
+  return phase*float(value);
+}
+/** Multiplies the mixer phase @c phase with a real sample. */
+inline std::complex<float> mixSample(const std::complex<float> &phase, float value) {
+  return phase*value;
+}
+/** Multiplies the mixer phase @c phase with a complex sample. */
+inline std::complex<float> mixSample(const std::complex<float> &phase,
+                                     const std::complex<int16_t> &value) {
+  return phase*std::complex<float>(value.real(), value.imag());
+}
+/** Multiplies the mixer phase @c phase with a complex sample. */
+inline std::complex<float> mixSample(const std::complex<float> &phase,
+                                     const std::complex<float> &value) {
+  return phase*value;
+}
+
+}
+
+#endif // __SDR_QRSS_SAMPLE_HH__
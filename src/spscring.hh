@@ -0,0 +1,83 @@
+#ifndef __SDR_QRSS_SPSCRING_HH__
+#define __SDR_QRSS_SPSCRING_HH__
+
+#include <atomic>
+#include <vector>
+#include <cstddef>
+#include <algorithm>
+
+
+namespace sdr {
+
+/** A lock-free single-producer single-consumer ring buffer.
+ * Exactly one thread may call @c put and exactly one (other) thread may call @c take. Neither
+ * of them ever blocks, @c put stores as many elements as there is space left and @c take returns
+ * as many elements as are available. */
+template <class Scalar>
+class SPSCRing
+{
+public:
+  /** Constructor.
+   * @param size Specifies the minimum capacity, the actual capacity is rounded up to the next
+   *        power of two. */
+  SPSCRing(size_t size=0)
+    : _data(), _mask(0), _head(0), _tail(0)
+  {
+    resize(size);
+  }
+
+  /** Resets and resizes the ring. Must not be called while a producer or consumer is active. */
+  void resize(size_t size) {
+    size_t cap = 1;
+    while (cap < size) { cap <<= 1; }
+    _data.resize(cap); _mask = cap-1;
+    _head.store(0, std::memory_order_relaxed);
+    _tail.store(0, std::memory_order_relaxed);
+  }
+
+  /** Returns the capacity of the ring. */
+  inline size_t capacity() const { return _data.size(); }
+
+  /** Returns the number of elements available for @c take. */
+  inline size_t available() const {
+    return _head.load(std::memory_order_acquire) - _tail.load(std::memory_order_acquire);
+  }
+
+  /** Stores up to @c n elements, returns the number of elements actually stored. */
+  size_t put(const Scalar *data, size_t n) {
+    size_t head = _head.load(std::memory_order_relaxed);
+    size_t tail = _tail.load(std::memory_order_acquire);
+    n = std::min(n, _data.size() - (head - tail));
+    for (size_t i=0; i<n; i++) {
+      _data[(head+i) & _mask] = data[i];
+    }
+    _head.store(head+n, std::memory_order_release);
+    return n;
+  }
+
+  /** Takes up to @c n elements, returns the number of elements actually taken. */
+  size_t take(Scalar *data, size_t n) {
+    size_t tail = _tail.load(std::memory_order_relaxed);
+    size_t head = _head.load(std::memory_order_acquire);
+    n = std::min(n, head - tail);
+    for (size_t i=0; i<n; i++) {
+      data[i] = _data[(tail+i) & _mask];
+    }
+    _tail.store(tail+n, std::memory_order_release);
+    return n;
+  }
+
+protected:
+  /** The storage. */
+  std::vector<Scalar> _data;
+  /** Index mask (capacity-1). */
+  size_t _mask;
+  /** Total number of elements stored, only written by the producer. */
+  std::atomic<size_t> _head;
+  /** Total number of elements taken, only written by the consumer. */
+  std::atomic<size_t> _tail;
+};
+
+}
+
+#endif // __SDR_QRSS_SPSCRING_HH__
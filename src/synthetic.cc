@@ -0,0 +1,246 @@
+#include "synthetic.hh"
+#include <cmath>
+#include <cctype>
+
+using namespace sdr;
+
+/** Number of interleaved phasors of the carrier synthesis. */
+#define GENERATOR_LANES 8
+
+
+/** Returns the Morse code of the given character as a string of '.' and '-'. */
+static const char *
+morseCode(char c) {
+  static const char *letters[26] = {
+    ".-", "-...", "-.-.", "-..", ".", "..-.", "--.", "....", "..", ".---", "-.-", ".-..", "--",
+    "-.", "---", ".--.", "--.-", ".-.", "...", "-", "..-", "...-", ".--", "-..-", "-.--", "--.." };
+  static const char *digits[10] = {
+    "-----", ".----", "..---", "...--", "....-", ".....", "-....", "--...", "---..", "----." };
+  c = std::toupper(c);
+  if (('A' <= c) && ('Z' >= c)) { return letters[c-'A']; }
+  if (('0' <= c) && ('9' >= c)) { return digits[c-'0']; }
+  if ('/' == c) { return "-..-."; }
+  return 0;
+}
+
+/** Adds the carrier of amplitude @c A, initial phase @c phase and frequency @c w (rad/sample)
+ * to @c re and @c im (if not 0). The carrier is generated by interleaved phasors, each rotated by
+ * @c GENERATOR_LANES samples per step, hence the inner loops are independent and vectorize. */
+static void
+addCarrier(float *re, float *im, size_t n, float A, double phase, double w) {
+  float zr[GENERATOR_LANES], zi[GENERATOR_LANES];
+  for (size_t k=0; k<GENERATOR_LANES; k++) {
+    zr[k] = A*std::cos(phase+w*k); zi[k] = A*std::sin(phase+w*k);
+  }
+  const float rr = std::cos(w*GENERATOR_LANES), ri = std::sin(w*GENERATOR_LANES);
+
+  size_t i=0;
+  for (; (i+GENERATOR_LANES)<=n; i+=GENERATOR_LANES) {
+    for (size_t k=0; k<GENERATOR_LANES; k++) { re[i+k] += zr[k]; }
+    if (im) {
+      for (size_t k=0; k<GENERATOR_LANES; k++) { im[i+k] += zi[k]; }
+    }
+    for (size_t k=0; k<GENERATOR_LANES; k++) {
+      float tr = zr[k]*rr - zi[k]*ri;
+      zi[k] = zr[k]*ri + zi[k]*rr; zr[k] = tr;
+    }
+  }
+  for (size_t k=0; i<n; i++, k++) {
+    re[i] += zr[k];
+    if (im) { im[i] += zi[k]; }
+  }
+}
+
+
+/* ********************************************************************************************* *
+ * Implementation of QRSSGenerator::Beacon
+ * ********************************************************************************************* */
+QRSSGenerator::Beacon::Beacon(Mode mode, double frequency, const std::string &text,
+                              double dotLength, double level, double shift, double drift,
+                              double fadingPeriod, double fadingDepth)
+  : mode(mode), frequency(frequency), text(text), dotLength(dotLength), level(level),
+    shift(shift), drift(drift), fadingPeriod(fadingPeriod), fadingDepth(fadingDepth)
+{
+  // pass...
+}
+
+
+/* ********************************************************************************************* *
+ * Implementation of QRSSGenerator
+ * ********************************************************************************************* */
+QRSSGenerator::QRSSGenerator(double sampleRate, double noiseLevel, uint32_t seed)
+  : _sampleRate(sampleRate), _noise(std::pow(10., noiseLevel/20)), _seed(seed ? seed : 1),
+    _state(GENERATOR_LANES), _sample(0), _beacons(), _keying(), _phase(), _scratch(), _normal()
+{
+  seedNoise();
+}
+
+double
+QRSSGenerator::sampleRate() const {
+  return _sampleRate;
+}
+
+void
+QRSSGenerator::addBeacon(const Beacon &beacon) {
+  // Assemble keying sequence in dot units: 1 key down, 0 key up, 2 dash (DFCW)
+  std::vector<int8_t> keys;
+  for (size_t i=0; i<beacon.text.size(); i++) {
+    const char *code = morseCode(beacon.text[i]);
+    if (0 == code) {
+      // word gap (7 units, 3 already sent after the last letter)
+      keys.insert(keys.end(), 4, 0); continue;
+    }
+    for (; *code; code++) {
+      if (MODE_DFCW == beacon.mode) { keys.push_back(('-' == *code) ? 2 : 1); }
+      else { keys.insert(keys.end(), ('-' == *code) ? 3 : 1, 1); }
+      keys.push_back(0);
+    }
+    // letter gap (3 units)
+    keys.insert(keys.end(), 2, 0);
+  }
+  // gap before repetition
+  keys.insert(keys.end(), 7, 0);
+
+  // Map to symbols
+  std::vector<int8_t> symbols(keys.size());
+  for (size_t i=0; i<keys.size(); i++) {
+    switch (beacon.mode) {
+    case MODE_CW: symbols[i] = keys[i] ? 0 : -1; break;
+    case MODE_FSK_CW: symbols[i] = keys[i] ? 1 : 0; break;
+    case MODE_DFCW: symbols[i] = keys[i]-1; break;
+    }
+  }
+
+  _beacons.push_back(beacon);
+  _keying.push_back(symbols);
+  _phase.push_back(0);
+}
+
+size_t
+QRSSGenerator::numBeacons() const {
+  return _beacons.size();
+}
+
+const QRSSGenerator::Beacon &
+QRSSGenerator::beacon(size_t idx) const {
+  return _beacons[idx];
+}
+
+double
+QRSSGenerator::time() const {
+  return _sample/_sampleRate;
+}
+
+void
+QRSSGenerator::reset() {
+  _sample = 0; seedNoise();
+  for (size_t i=0; i<_phase.size(); i++) { _phase[i] = 0; }
+}
+
+int
+QRSSGenerator::symbol(size_t idx, uint64_t unit) const {
+  const std::vector<int8_t> &keying = _keying[idx];
+  return keying[unit % keying.size()];
+}
+
+bool
+QRSSGenerator::keyed(size_t idx, double t, double *F) const {
+  const Beacon &beacon = _beacons[idx];
+  int sym = symbol(idx, uint64_t(t/beacon.dotLength));
+  if (F) { *F = beacon.frequency + beacon.drift*t/60 + ((sym > 0) ? beacon.shift : 0); }
+  return (sym >= 0);
+}
+
+void
+QRSSGenerator::generate(float *out, size_t n) {
+  _generate(out, 0, n);
+}
+
+void
+QRSSGenerator::generate(std::complex<float> *out, size_t n) {
+  _scratch.resize(2*n);
+  _generate(_scratch.data(), _scratch.data()+n, n);
+  for (size_t i=0; i<n; i++) {
+    out[i] = std::complex<float>(_scratch[i], _scratch[n+i]);
+  }
+}
+
+void
+QRSSGenerator::_generate(float *re, float *im, size_t n) {
+  std::fill(re, re+n, 0.f);
+  if (im) { std::fill(im, im+n, 0.f); }
+
+  for (size_t b=0; b<_beacons.size(); b++) {
+    const Beacon &beacon = _beacons[b];
+    double unitSamples = beacon.dotLength*_sampleRate;
+    // Split the block into segments of constant keying
+    for (size_t i=0; i<n;) {
+      uint64_t sample = _sample+i;
+      uint64_t unit = uint64_t(sample/unitSamples);
+      uint64_t end = std::max(sample+1, uint64_t(std::ceil((unit+1)*unitSamples)));
+      size_t m = std::min(n-i, size_t(end-sample));
+
+      double t = sample/_sampleRate;
+      int sym = symbol(b, unit);
+      double F = beacon.frequency + beacon.drift*t/60 + ((sym > 0) ? beacon.shift : 0);
+      double w = 2*M_PI*F/_sampleRate;
+      if (sym >= 0) {
+        double A = std::pow(10., beacon.level/20);
+        if (beacon.fadingPeriod > 0) {
+          A *= 1 - beacon.fadingDepth*0.5*(1-std::cos(2*M_PI*t/beacon.fadingPeriod));
+        }
+        addCarrier(re+i, (im ? im+i : 0), m, A, _phase[b], w);
+      }
+      _phase[b] = std::fmod(_phase[b] + w*m, 2*M_PI);
+      i += m;
+    }
+  }
+
+  _sample += n;
+  _addNoise(re, n, _noise);
+  if (im) { _addNoise(im, n, _noise); }
+}
+
+void
+QRSSGenerator::seedNoise() {
+  // Distinct non-zero seeds for each lane
+  for (size_t k=0; k<GENERATOR_LANES; k++) {
+    _state[k] = _seed + 0x9E3779B9u*uint32_t(k);
+    if (0 == _state[k]) { _state[k] = k+1; }
+  }
+}
+
+void
+QRSSGenerator::_addNoise(float *out, size_t n, float sigma) {
+  // Each normal sample is the sum of 12 uniform 16bit samples minus their mean (Irwin-Hall),
+  // which has unit variance and is cut at 6 sigma. The uniform samples are the halves of the
+  // outputs of interleaved xorshift generators, one per lane. Everything but the final scaling
+  // is integer arithmetic and the lanes are independent, hence the inner loops vectorize.
+  _normal.resize((n+GENERATOR_LANES-1)/GENERATOR_LANES*GENERATOR_LANES);
+  uint32_t state[GENERATOR_LANES];
+  std::copy(_state.begin(), _state.end(), state);
+  const float scale = sigma/65536;
+  for (size_t i=0; i<_normal.size(); i+=GENERATOR_LANES) {
+    int32_t sum[GENERATOR_LANES];
+    for (size_t k=0; k<GENERATOR_LANES; k++) { sum[k] = 0; }
+    for (size_t j=0; j<6; j++) {
+      for (size_t k=0; k<GENERATOR_LANES; k++) {
+        state[k] ^= state[k] << 13; state[k] ^= state[k] >> 17; state[k] ^= state[k] << 5;
+        sum[k] += int32_t(state[k] & 0xffff) + int32_t(state[k] >> 16);
+      }
+    }
+    for (size_t k=0; k<GENERATOR_LANES; k++) {
+      // The mean of the sum is 12*32767.5
+      _normal[i+k] = float(sum[k] - 393210)*scale;
+    }
+  }
+  std::copy(state, state+GENERATOR_LANES, _state.begin());
+  for (size_t i=0; i<n; i++) { out[i] += _normal[i]; }
+}
+
+QRSSGenerator::Mode
+QRSSGenerator::modeFromName(const std::string &name) {
+  if (("fsk" == name) || ("fsk-cw" == name)) { return MODE_FSK_CW; }
+  if ("dfcw" == name) { return MODE_DFCW; }
+  return MODE_CW;
+}
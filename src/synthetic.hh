@@ -0,0 +1,330 @@
+#ifndef __SDR_QRSS_SYNTHETIC_HH__
+#define __SDR_QRSS_SYNTHETIC_HH__
+
+#include <node.hh>
+#include <queue.hh>
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdint.h>
+#include <algorithm>
+#include <string>
+#include <type_traits>
+#include <vector>
+#include <time.h>
+#include "sample.hh"
+#include "realtime.hh"
+#include "spscring.hh"
+
+
+namespace sdr {
+
+/** Synthesizes QRSS beacons in Gaussian noise with known signal positions.
+ *
+ * Each beacon sends its text repeatedly in Morse code in one of three modes: CW (on/off keying),
+ * FSK-CW (the carrier is shifted up while the key is down) and DFCW (dots and dashes are of
+ * equal length but on different frequencies). The carrier may drift linearly and fade
+ * periodically.
+ *
+ * The signal is generated block-wise. Within a block, the keying, frequency and amplitude of a
+ * beacon are constant between element boundaries and each such segment is generated by several
+ * interleaved phasors rotating in parallel, hence the inner loops vectorize. Likewise, the
+ * noise is drawn from interleaved xorshift generators. Each noise sample is the sum of 12
+ * uniform ones, which approximates a normal distribution up to 6 sigma (Irwin-Hall) with
+ * integer arithmetic only. */
+class QRSSGenerator
+{
+public:
+  /** The keying modes. */
+  typedef enum {
+    MODE_CW,      ///< On/off keying.
+    MODE_FSK_CW,  ///< Frequency shift keying, the carrier is shifted up while the key is down.
+    MODE_DFCW     ///< Dual-frequency CW, dashes are sent on the shifted frequency.
+  } Mode;
+
+  /** Description of a single beacon. */
+  class Beacon {
+  public:
+    /** Constructor. */
+    Beacon(Mode mode=MODE_CW, double frequency=800, const std::string &text="QRSS",
+           double dotLength=3, double level=-40, double shift=5, double drift=0,
+           double fadingPeriod=0, double fadingDepth=0);
+
+  public:
+    /** The keying mode. */
+    Mode mode;
+    /** The carrier frequency in Hz. */
+    double frequency;
+    /** The text sent. */
+    std::string text;
+    /** The length of a dot in s. */
+    double dotLength;
+    /** The peak amplitude of the carrier in dB full-scale. */
+    double level;
+    /** The frequency shift of FSK-CW and DFCW in Hz. */
+    double shift;
+    /** The carrier drift in Hz per minute. */
+    double drift;
+    /** The period of the fading in s, 0 disables fading. */
+    double fadingPeriod;
+    /** The depth of the fading in [0,1]. */
+    double fadingDepth;
+  };
+
+public:
+  /** Constructor.
+   * @param sampleRate Specifies the sample rate in Hz.
+   * @param noiseLevel Specifies the RMS of the noise in dB full-scale (of each component for
+   *        the IQ signal).
+   * @param seed Specifies the seed of the noise generator. */
+  QRSSGenerator(double sampleRate, double noiseLevel=-60, uint32_t seed=1);
+
+  /** Returns the sample rate. */
+  double sampleRate() const;
+  /** Adds a beacon. */
+  void addBeacon(const Beacon &beacon);
+  /** Returns the number of beacons. */
+  size_t numBeacons() const;
+  /** Returns the specified beacon. */
+  const Beacon &beacon(size_t idx) const;
+
+  /** Returns the time of the next sample in s. */
+  double time() const;
+  /** Restarts the signal at time 0. */
+  void reset();
+
+  /** Returns @c true if the carrier of the specified beacon is present at time @c t (always the
+   * case for FSK-CW), its frequency is then stored into @c F. */
+  bool keyed(size_t idx, double t, double *F=0) const;
+
+  /** Generates the next @c n samples of the real signal (full-scale is 1). */
+  void generate(float *out, size_t n);
+  /** Generates the next @c n samples of the analytic (IQ) signal (full-scale is 1). */
+  void generate(std::complex<float> *out, size_t n);
+
+  /** Parses a mode name ("cw", "fsk" or "dfcw"). */
+  static Mode modeFromName(const std::string &name);
+
+protected:
+  /** Generates @c n samples into @c re and @c im, @c im may be 0 for a real signal. */
+  void _generate(float *re, float *im, size_t n);
+  /** Adds the (approximately) Gaussian noise of standard deviation @c sigma. */
+  void _addNoise(float *out, size_t n, float sigma);
+  /** Restarts the noise generators from the seed. */
+  void seedNoise();
+  /** Returns the keying symbol of the beacon at element @c unit: -1 off, 0 carrier, 1 shifted. */
+  int symbol(size_t idx, uint64_t unit) const;
+
+protected:
+  /** The sample rate. */
+  double _sampleRate;
+  /** The RMS of the noise. */
+  float _noise;
+  /** Seed of the noise generator. */
+  uint32_t _seed;
+  /** State of the noise generator of each lane. */
+  std::vector<uint32_t> _state;
+  /** Index of the next sample. */
+  uint64_t _sample;
+  /** The beacons. */
+  std::vector<Beacon> _beacons;
+  /** The keying sequence of each beacon in dot units, see @c symbol. */
+  std::vector< std::vector<int8_t> > _keying;
+  /** The carrier phase of each beacon. */
+  std::vector<double> _phase;
+  /** Scratch buffers for the imaginary part and the noise samples. */
+  std::vector<float> _scratch, _normal;
+};
+
+
+/** A source node, that produces the signal of a @c QRSSGenerator.
+ *
+ * Like @c AudioInput, the blocks are generated by a dedicated thread and posted to the queue,
+ * which passes them to the connected sinks from within the queue thread. Hence, sinks should be
+ * connected directly and must not keep a reference to the blocks. If paced, the thread sleeps
+ * until each block is due in real time. Otherwise blocks are generated as fast as the queue
+ * releases them. The thread runs while the queue is running.
+ *
+ * The indices of the free blocks are kept in a lock-free ring. The thread takes a free block,
+ * fills and posts it, @c handleBuffer returns it after the sinks have processed it and wakes up
+ * the thread.
+ *
+ * Without a running queue, @c next generates and sends blocks synchronously (e.g. for offline
+ * processing).
+ *
+ * @c Scalar is either a real sample type or a complex one (IQ signal). */
+template <class Scalar>
+class GeneratorSource: public Source, public SinkBase
+{
+public:
+  /** Constructor.
+   * @param sampleRate Specifies the sample rate in Hz.
+   * @param bufferSize Specifies the number of samples per block.
+   * @param paced If @c true, the blocks are generated in real time.
+   * @param noiseLevel Specifies the RMS of the noise in dB full-scale.
+   * @param seed Specifies the seed of the noise generator. */
+  GeneratorSource(double sampleRate, size_t bufferSize, bool paced=true, double noiseLevel=-60,
+                  uint32_t seed=1)
+    : Source(), SinkBase(), _generator(sampleRate, noiseLevel, seed), _bufferSize(bufferSize),
+      _paced(paced), _blocks(), _free(8), _signal(bufferSize), _count(0), _running(false)
+  {
+    sem_init(&_released, 0, 0);
+    for (size_t i=0; i<8; i++) {
+      _blocks.push_back(Buffer<Scalar>(bufferSize));
+      release(i);
+    }
+    this->setConfig(Config(Config::typeId<Scalar>(), sampleRate, bufferSize, _blocks.size()));
+    Queue::get().addStart(this, &GeneratorSource<Scalar>::start);
+    Queue::get().addStop(this, &GeneratorSource<Scalar>::stop);
+  }
+
+  /** Destructor. */
+  virtual ~GeneratorSource() {
+    Queue::get().remStart(this);
+    Queue::get().remStop(this);
+    stop();
+    sem_destroy(&_released);
+  }
+
+  /** Returns the signal generator. */
+  QRSSGenerator &generator() { return _generator; }
+  /** Returns @c true if the blocks are generated in real time. */
+  bool paced() const { return _paced; }
+  /** Enables/Disables real time generation. */
+  void setPaced(bool paced) { _paced = paced; }
+  /** Returns the number of generated blocks since start. */
+  size_t blocks() const { return _count; }
+
+  /** Starts the generator thread, called on the start of the queue. */
+  void start() {
+    if (_running) { return; }
+    _count = 0; _running = true;
+    pthread_create(&_thread, 0, &GeneratorSource<Scalar>::_generator_main, this);
+  }
+
+  /** Stops the generator thread, called on the stop of the queue. */
+  void stop() {
+    if (! _running) { return; }
+    _running = false;
+    sem_post(&_released);
+    pthread_join(_thread, 0);
+  }
+
+  /** Waits until the queue processed all blocks posted before @c stop, hence the source may be
+   * deleted while the queue keeps running. Must not be called from the queue thread. */
+  void wait() {
+    while (_free.available() < _blocks.size()) {
+      struct timespec ts; ts.tv_sec = 0; ts.tv_nsec = 1000000L;
+      nanosleep(&ts, 0);
+    }
+  }
+
+  /** Generates the next block and sends it to the connected sinks immediately. Must not be
+   * called while the generator thread is running. Returns @c false if all blocks are still
+   * posted to the queue. */
+  bool next() {
+    size_t idx;
+    if ((0 != sem_trywait(&_released)) || (0 == _free.take(&idx, 1))) { return false; }
+    fill(_blocks[idx]);
+    this->send(_blocks[idx]);
+    release(idx);
+    return true;
+  }
+
+  /** Unused, this node is not connected to any source. */
+  virtual void config(const Config &src_cfg) {
+    // pass...
+  }
+
+  /** Receives the blocks posted by the generator thread within the queue thread, passes them
+   * to the connected sinks and returns them to the generator thread. */
+  virtual void handleBuffer(const RawBuffer &buffer, bool allow_overwrite) {
+    size_t idx = 0;
+    while ((idx < _blocks.size()) && (_blocks[idx].data() != buffer.data())) { idx++; }
+    if (_blocks.size() == idx) { return; }
+    this->send(buffer, allow_overwrite);
+    release(idx);
+  }
+
+protected:
+  /** The type of the generated signal, real or complex. */
+  typedef typename std::conditional<std::is_same<Scalar, std::complex<Sample> >::value,
+  std::complex<float>, float>::type Signal;
+
+  /** Converts real samples. */
+  static inline void convert(const float *in, Sample *out, size_t n) {
+    const float scale = SampleTraits<Sample>::fullScale();
+    for (size_t i=0; i<n; i++) { out[i] = SampleTraits<Sample>::fromFloat(scale*in[i]); }
+  }
+  /** Converts complex samples. */
+  static inline void convert(const std::complex<float> *in, std::complex<Sample> *out, size_t n) {
+    const float scale = SampleTraits<Sample>::fullScale();
+    for (size_t i=0; i<n; i++) {
+      out[i] = std::complex<Sample>(SampleTraits<Sample>::fromFloat(scale*in[i].real()),
+                                    SampleTraits<Sample>::fromFloat(scale*in[i].imag()));
+    }
+  }
+
+  /** Generates the next block into @c block. */
+  void fill(Buffer<Scalar> &block) {
+    _generator.generate(_signal.data(), _bufferSize);
+    convert(_signal.data(), reinterpret_cast<Scalar *>(block.data()), _bufferSize);
+    _count++;
+  }
+
+  /** Returns the specified block to the free ring and wakes up the generator thread. */
+  void release(size_t idx) {
+    _free.put(&idx, 1);
+    sem_post(&_released);
+  }
+
+  /** The main loop of the generator thread. */
+  static void *_generator_main(void *ctx) {
+    GeneratorSource<Scalar> *self = reinterpret_cast<GeneratorSource<Scalar> *>(ctx);
+    int64_t blockNs = 1e9*self->_bufferSize/self->_generator.sampleRate();
+    // Time at which the next block is due, restarted whenever the pacing is enabled
+    int64_t due = monotonicNs(); bool paced = false;
+    size_t idx;
+    while (self->_running) {
+      // Wait until a block is released by the queue and the sinks
+      sem_wait(&self->_released);
+      if ((! self->_running) || (0 == self->_free.take(&idx, 1))) { continue; }
+      Buffer<Scalar> &block = self->_blocks[idx];
+      if (self->_paced) {
+        if (! paced) { due = monotonicNs(); }
+        struct timespec ts; ts.tv_sec = due/1000000000LL; ts.tv_nsec = due%1000000000LL;
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, 0);
+        due += blockNs;
+      }
+      paced = self->_paced;
+      self->fill(block);
+      Queue::get().send(block, self);
+    }
+    return 0;
+  }
+
+protected:
+  /** The signal generator. */
+  QRSSGenerator _generator;
+  /** The number of samples per block. */
+  size_t _bufferSize;
+  /** If @c true, the blocks are generated in real time. */
+  volatile bool _paced;
+  /** The block buffers. */
+  std::vector< Buffer<Scalar> > _blocks;
+  /** Indices of the free blocks, returned by @c handleBuffer and taken by the thread. */
+  SPSCRing<size_t> _free;
+  /** Counts the released blocks. */
+  sem_t _released;
+  /** The generated signal. */
+  std::vector<Signal> _signal;
+  /** Number of generated blocks since start. */
+  volatile size_t _count;
+  /** If @c true, the generator thread is running. */
+  volatile bool _running;
+  /** The generator thread. */
+  pthread_t _thread;
+};
+
+}
+
+#endif // __SDR_QRSS_SYNTHETIC_HH__